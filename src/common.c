@@ -154,19 +154,41 @@ int waitpid_timeout(const char *name, pid_t pid, int *pstatus, int timeout)
 }
 
 
-int waitid_timeout(const char *name, id_t pid, siginfo_t * info, int timeout)
+/* See set_child_wait_hook */
+static void (*child_wait_hook) (void) = NULL;
+
+/* See set_command_pgid_record */
+static volatile pid_t *command_pgid_record = NULL;
+
+void set_child_wait_hook(void (*hook) (void))
+{
+	child_wait_hook = hook;
+}
+
+void set_command_pgid_record(volatile pid_t * record)
+{
+	command_pgid_record = record;
+}
+
+/*
+ * The old way of waiting, for kernels without pidfd_open(2) (before 5.3):
+ * poll with a delay that doubles up to a second, so the end of a command
+ * may be noticed up to a second late.
+ */
+static int waitid_timeout_poll(const char *name, id_t pid, siginfo_t * info,
+			       int timeout)
 {
 	int timeout_ms = 1000 * timeout;	/* timeout in ms */
 	const int max_delay = 1000;	/* max delay between waitpid calls */
 	int delay = 10;		/* initial delay */
 	int rc;
-	int options = WEXITED | WNOHANG;
+	/* Leave the child to be reaped by waitid_timeout, for its rusage */
+	int options = WEXITED | WNOHANG | WNOWAIT;
     idtype_t type = P_PID;
 
-	log_trace("Entered waitid_timeout function.");
-
-	if (timeout <= 0)
-		options = 0;
+	/* With a hook to call, we have to keep polling even with no timeout */
+	if (timeout <= 0 && child_wait_hook == NULL)
+		options = WEXITED | WNOWAIT;
 
     errno = 0;
 	info->si_pid = 0;
@@ -194,7 +216,7 @@ int waitid_timeout(const char *name, id_t pid, siginfo_t * info, int timeout)
                 return (-1);
             }
 		}
-		if (timeout_ms <= 0) {
+		if (timeout > 0 && timeout_ms <= 0) {
 			log_info("%s%stimeout after %ds: killing pgid %d",
 				 name != NULL ? name : "",
 				 name != NULL ? ": " : "", timeout, pid);
@@ -207,8 +229,14 @@ int waitid_timeout(const char *name, id_t pid, siginfo_t * info, int timeout)
 			break;
 		} else {
 			(void)poll(NULL, 0, delay);
+			if (child_wait_hook != NULL) {
+				child_wait_hook();
+			}
 			timeout_ms -= delay;
-			delay = MIN(timeout_ms, MIN(max_delay, delay * 2));
+			delay = MIN(max_delay, delay * 2);
+			if (timeout > 0) {
+				delay = MIN(timeout_ms, delay);
+			}
 		}
 	} while (rc <= 0);
 
@@ -216,61 +244,739 @@ int waitid_timeout(const char *name, id_t pid, siginfo_t * info, int timeout)
 	return (0);
 }
 
-/* The way that we are timing execution isn't the best */
-int run_command(const char *command, double *time, int timeout)
+/*
+ * Wait for the child to exit by polling a pidfd for it, which becomes
+ * readable the moment it does, along with a timerfd for the timeout.  The
+ * child wait hook, if set, is called every second meanwhile.  Returns -2 if
+ * the kernel cannot give us a pidfd, so that the caller can fall back on
+ * waitid_timeout_poll.
+ */
+static int waitid_timeout_pidfd(const char *name, id_t pid, siginfo_t * info,
+				int timeout)
+{
+	struct pollfd fds[2];
+	struct itimerspec expiry;
+	int pidfd, timerfd = -1;
+	int nfds = 1;
+	int rc;
+	bool timed_out = false;
+
+	pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd < 0) {
+		log_debug("pidfd_open: %s", strerror(errno));
+		return (-2);
+	}
+	fds[0].fd = pidfd;
+	fds[0].events = POLLIN;
+	if (timeout > 0) {
+		timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (timerfd < 0) {
+			log_debug("timerfd_create: %s", strerror(errno));
+			close(pidfd);
+			return (-2);
+		}
+		memset(&expiry, 0, sizeof(expiry));
+		expiry.it_value.tv_sec = timeout;
+		timerfd_settime(timerfd, 0, &expiry, NULL);
+		fds[1].fd = timerfd;
+		fds[1].events = POLLIN;
+		nfds = 2;
+	}
+
+	info->si_pid = 0;
+	info->si_status = 0;
+	info->si_signo = SIGCHLD;
+	for (;;) {
+		rc = poll(fds, nfds, child_wait_hook != NULL ? 1000 : -1);
+		if (rc < 0 && errno != EINTR) {
+			log_error("poll: %s", strerror(errno));
+			break;
+		}
+		if (rc > 0 && (fds[0].revents & (POLLIN | POLLHUP))) {
+			/* It has exited, so this will not block */
+			do {
+				rc = waitid(P_PID, pid, info, WEXITED | WNOWAIT);
+			} while (rc < 0 && errno == EINTR);
+			if (rc < 0) {
+				log_error("waitid: %s", strerror(errno));
+			}
+			break;
+		}
+		if (rc > 0 && nfds > 1 && (fds[1].revents & POLLIN)) {
+			log_info("%s%stimeout after %ds: killing pgid %d",
+				 name != NULL ? name : "",
+				 name != NULL ? ": " : "", timeout, pid);
+			killpg(pid, SIGKILL);
+			do {
+				rc = waitid(P_PID, pid, info, WEXITED | WNOWAIT);
+			} while (rc < 0 && errno == EINTR);
+			/* This allows the calling function to know that the child
+			 * exited because it was killed and not for some other reason. */
+			info->si_code = CLD_KILLED;
+			info->si_status = SIGKILL;
+			timed_out = true;
+			rc = 0;
+			break;
+		}
+		if (child_wait_hook != NULL) {
+			child_wait_hook();
+		}
+	}
+	close(pidfd);
+	if (timerfd >= 0) {
+		close(timerfd);
+	}
+	killpg(pid, SIGKILL);	/* kill children too */
+
+	if (rc < 0) {
+		return (-1);
+	}
+	if (!timed_out
+	    && (info->si_code == CLD_KILLED || info->si_code == CLD_DUMPED)) {
+		log_debug("Child process killed by signal %d", info->si_status);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Wait for the child as below, then reap it with wait4 to get its rusage,
+ * which covers everything it waited for in turn.
+ */
+int waitid_timeout(const char *name, id_t pid, siginfo_t * info,
+		   struct rusage *usage, int timeout)
+{
+	int rc, status;
+
+	log_trace("Entered waitid_timeout function.");
+
+	rc = waitid_timeout_pidfd(name, pid, info, timeout);
+	if (rc == -2) {
+		rc = waitid_timeout_poll(name, pid, info, timeout);
+	}
+	/* Either way, it has exited or been killed by now */
+	while (wait4(pid, &status, 0, usage) < 0) {
+		if (errno != EINTR) {
+			memset(usage, 0, sizeof(*usage));
+			break;
+		}
+	}
+	return rc;
+}
+
+double opt_monotonic_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * The total and idle (including waiting for I/O) jiffies of all CPUs so far,
+ * from the first line of /proc/stat.
+ */
+static int read_cpu_jiffies(unsigned long long *total,
+			    unsigned long long *idle)
+{
+	unsigned long long value[8] = { 0 };
+	FILE *stat = NULL;
+	int i, count;
+
+	stat = fopen("/proc/stat", "r");
+	if (stat == NULL) {
+		return -1;
+	}
+	count = fscanf(stat, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		       &value[0], &value[1], &value[2], &value[3], &value[4],
+		       &value[5], &value[6], &value[7]);
+	fclose(stat);
+	if (count < 4) {
+		return -1;
+	}
+	*total = 0;
+	for (i = 0; i < 8; i++) {
+		*total += value[i];
+	}
+	*idle = value[3] + value[4];
+	return 0;
+}
+
+/* In MHz; -1 where cpufreq is not available, eg in a VM */
+static double read_cpu_freq(void)
+{
+	const char *format = "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq";
+	char path[MAX_FILENAME_SIZE];
+	double sum = 0.0;
+	long khz;
+	FILE *file = NULL;
+	int cpu, count = 0;
+
+	for (cpu = 0; ; cpu++) {
+		snprintf(path, sizeof(path), format, cpu);
+		file = fopen(path, "r");
+		if (file == NULL) {
+			break;
+		}
+		if (fscanf(file, "%ld", &khz) == 1) {
+			sum += khz / 1000.0;
+			count++;
+		}
+		fclose(file);
+	}
+	return count > 0 ? sum / count : -1.0;
+}
+
+void sample_node_noise(opt_node_noise_t * noise, double interval)
+{
+	unsigned long long total[2], idle[2];
+	struct timespec pause;
+	FILE *loadavg = NULL;
+	int ok;
+
+	noise->load = -1.0;
+	noise->busy = -1.0;
+	ok = read_cpu_jiffies(&total[0], &idle[0]) == 0;
+	pause.tv_sec = (time_t) interval;
+	pause.tv_nsec = (long)((interval - pause.tv_sec) * 1e9);
+	while (nanosleep(&pause, &pause) < 0 && errno == EINTR) ;
+	if (ok && read_cpu_jiffies(&total[1], &idle[1]) == 0
+	    && total[1] > total[0]) {
+		noise->busy = 100.0 * (1.0 - (double)(idle[1] - idle[0]) /
+				       (total[1] - total[0]));
+	}
+	loadavg = fopen("/proc/loadavg", "r");
+	if (loadavg != NULL) {
+		if (fscanf(loadavg, "%lf", &noise->load) != 1) {
+			noise->load = -1.0;
+		}
+		fclose(loadavg);
+	}
+	noise->freq = read_cpu_freq();
+}
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *byte = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= byte[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int hash_file(const char *path, uint64_t * hash)
+{
+	char buffer[65536];
+	size_t count;
+	FILE *file = NULL;
+	int rc = 0;
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		return -1;
+	}
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		*hash = hash_bytes(*hash, buffer, count);
+	}
+	if (ferror(file)) {
+		rc = -1;
+	}
+	fclose(file);
+	return rc;
+}
+
+/* As hash_tree, with the paths hashed relative to root, of which dir is part */
+static int hash_subtree(const char *root, const char *dir, uint64_t * hash)
+{
+	struct dirent **entries = NULL;
+	struct stat info;
+	char path[MAX_FILENAME_SIZE];
+	char target[MAX_FILENAME_SIZE];
+	const char *name = NULL;
+	ssize_t length;
+	int i, count, rc = 0;
+
+	count = scandir(dir, &entries, NULL, alphasort);
+	if (count < 0) {
+		log_error("Unable to read directory %s: %s", dir,
+			  strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		name = entries[i]->d_name;
+		if (rc != 0 || !strcmp(name, ".") || !strcmp(name, "..")) {
+			free(entries[i]);
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		free(entries[i]);
+		/* The name and what it is, so that moving a file or turning it
+		 * into a link changes the hash */
+		*hash = hash_bytes(*hash, path + strlen(root),
+				   strlen(path + strlen(root)) + 1);
+		if (lstat(path, &info) < 0) {
+			rc = -1;
+		} else if (S_ISDIR(info.st_mode)) {
+			*hash = hash_bytes(*hash, "d", 1);
+			rc = hash_subtree(root, path, hash);
+		} else if (S_ISLNK(info.st_mode)) {
+			*hash = hash_bytes(*hash, "l", 1);
+			length = readlink(path, target, sizeof(target));
+			if (length < 0) {
+				rc = -1;
+			} else {
+				*hash = hash_bytes(*hash, target, length);
+			}
+		} else if (S_ISREG(info.st_mode)) {
+			*hash = hash_bytes(*hash, "f", 1);
+			rc = hash_file(path, hash);
+		}
+		if (rc != 0) {
+			log_error("Unable to hash %s", path);
+		}
+	}
+	free(entries);
+	return rc;
+}
+
+int hash_tree(const char *dir, uint64_t * hash)
+{
+	return hash_subtree(dir, dir, hash);
+}
+
+/* Blank the description of any GNU build ID among the notes at data */
+static void blank_build_id(unsigned char *data, size_t size)
+{
+	Elf64_Nhdr note;	/* The same as Elf32_Nhdr */
+	size_t offset = 0, name, desc;
+
+	while (offset + sizeof(note) <= size) {
+		memcpy(&note, data + offset, sizeof(note));
+		name = offset + sizeof(note);
+		desc = name + ((note.n_namesz + 3) & ~3UL);
+		if (desc > size || note.n_descsz > size - desc) {
+			return;
+		}
+		if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4
+		    && !memcmp(data + name, "GNU", 4)) {
+			memset(data + desc, 0, note.n_descsz);
+		}
+		offset = desc + ((note.n_descsz + 3) & ~3UL);
+	}
+}
+
+/*
+ * The notes of an ELF file of our own byte order may be found both from
+ * its section headers and, in an executable, its program headers.
+ */
+#define BLANK_ELF_BUILD_ID(Ehdr, Shdr, Phdr)				\
+	do {								\
+		Ehdr header;						\
+		Shdr section;						\
+		Phdr segment;						\
+		size_t i, at;						\
+									\
+		if (size < sizeof(header)) {				\
+			return;						\
+		}							\
+		memcpy(&header, data, sizeof(header));			\
+		for (i = 0; i < header.e_shnum; i++) {			\
+			at = header.e_shoff + i * header.e_shentsize;	\
+			if (at + sizeof(section) > size) {		\
+				break;					\
+			}						\
+			memcpy(&section, data + at, sizeof(section));	\
+			if (section.sh_type == SHT_NOTE			\
+			    && section.sh_offset <= size		\
+			    && section.sh_size <= size - section.sh_offset) { \
+				blank_build_id(data + section.sh_offset,	\
+					       section.sh_size);	\
+			}						\
+		}							\
+		for (i = 0; i < header.e_phnum; i++) {			\
+			at = header.e_phoff + i * header.e_phentsize;	\
+			if (at + sizeof(segment) > size) {		\
+				break;					\
+			}						\
+			memcpy(&segment, data + at, sizeof(segment));	\
+			if (segment.p_type == PT_NOTE			\
+			    && segment.p_offset <= size			\
+			    && segment.p_filesz <= size - segment.p_offset) { \
+				blank_build_id(data + segment.p_offset,	\
+					       segment.p_filesz);	\
+			}						\
+		}							\
+	} while (0)
+
+/* See hash_build_files */
+static void normalise_build_file(unsigned char *data, size_t size)
+{
+	const uint16_t one = 1;
+	const int host_order = *(const unsigned char *)&one ?
+	    ELFDATA2LSB : ELFDATA2MSB;
+	size_t offset, member;
+
+	if (size > EI_DATA && !memcmp(data, ELFMAG, SELFMAG)
+	    && data[EI_DATA] == host_order) {
+		if (data[EI_CLASS] == ELFCLASS64) {
+			BLANK_ELF_BUILD_ID(Elf64_Ehdr, Elf64_Shdr, Elf64_Phdr);
+		} else if (data[EI_CLASS] == ELFCLASS32) {
+			BLANK_ELF_BUILD_ID(Elf32_Ehdr, Elf32_Shdr, Elf32_Phdr);
+		}
+	} else if (size >= 8 && !memcmp(data, "!<arch>\n", 8)) {
+		/* Each member has a 60 byte header: name, date, uid, gid,
+		 * mode, size and a terminator, with the data padded to even */
+		for (offset = 8; offset + 60 <= size;
+		     offset += 60 + member + (member & 1)) {
+			member = strtoul((char *)data + offset + 48, NULL, 10);
+			memset(data + offset + 16, ' ', 32);
+		}
+	}
+}
+
+#undef BLANK_ELF_BUILD_ID
+
+static int hash_build_file(const char *path, uint64_t * hash)
+{
+	unsigned char *data = NULL;
+	struct stat info;
+	FILE *file = NULL;
+	int rc = 0;
+
+	file = fopen(path, "rb");
+	if (file == NULL || fstat(fileno(file), &info) < 0) {
+		log_error("Unable to read %s: %s", path, strerror(errno));
+		if (file != NULL) {
+			fclose(file);
+		}
+		return -1;
+	}
+	data = malloc(info.st_size + 1);
+	if (data == NULL
+	    || fread(data, 1, info.st_size, file) != (size_t) info.st_size) {
+		log_error("Unable to read %s", path);
+		rc = -1;
+	} else {
+		normalise_build_file(data, info.st_size);
+		*hash = hash_bytes(*hash, path, strlen(path) + 1);
+		*hash = hash_bytes(*hash, data, info.st_size);
+	}
+	free(data);
+	fclose(file);
+	return rc;
+}
+
+int hash_build_files(const char *patterns, uint64_t * hash)
+{
+	struct stat info;
+	glob_t found;
+	char *copy = NULL;
+	char *pattern = NULL;
+	char *saveptr = NULL;
+	size_t i;
+	int rc, count = 0;
+
+	memset(&found, 0, sizeof(found));
+	copy = strdup(patterns);
+	for (pattern = strtok_r(copy, " \t", &saveptr); pattern != NULL;
+	     pattern = strtok_r(NULL, " \t", &saveptr)) {
+		rc = glob(pattern, GLOB_BRACE | (count++ > 0 ? GLOB_APPEND : 0),
+			  NULL, &found);
+		if (rc != 0 && rc != GLOB_NOMATCH) {
+			log_error("Unable to expand %s", pattern);
+			count = -1;
+			break;
+		}
+	}
+	free(copy);
+
+	if (count >= 0) {
+		count = 0;
+		for (i = 0; i < found.gl_pathc; i++) {
+			if (stat(found.gl_pathv[i], &info) < 0
+			    || !S_ISREG(info.st_mode)) {
+				continue;
+			}
+			if (hash_build_file(found.gl_pathv[i], hash) != 0) {
+				count = -1;
+				break;
+			}
+			count++;
+		}
+	}
+	globfree(&found);
+	return count;
+}
+
+/* See set_command_counters */
+static bool count_events = false;
+
+void set_command_counters(bool enable)
+{
+	count_events = enable;
+}
+
+/*
+ * The counters run_command_usage attaches, in the order of their fields in
+ * opt_command_usage_t.  Only user space is counted, which is where the
+ * compiler's work shows, and which perf_event_paranoid allows by default.
+ */
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+} command_events[] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock" }
+};
+
+#define NUM_COMMAND_EVENTS 3
+
+/*
+ * Open the counters, disabled, on this thread, with inherit set so that the
+ * child spawned next and everything it starts are counted too; the counts
+ * of each are added in as it exits.  A counter that cannot be opened (no
+ * PMU, as in many VMs, or not allowed) is left as -1.
+ */
+static void open_command_counters(int *fds)
+{
+	struct perf_event_attr attr;
+	static bool warned = false;
+	int i;
+
+	for (i = 0; i < NUM_COMMAND_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = command_events[i].type;
+		attr.config = command_events[i].config;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		    PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+				 PERF_FLAG_FD_CLOEXEC);
+		if (fds[i] < 0 && !warned) {
+			log_warn("Unable to count %s for commands: %s",
+				 command_events[i].name, strerror(errno));
+		}
+	}
+	warned = true;
+	for (i = 0; i < NUM_COMMAND_EVENTS; i++) {
+		if (fds[i] >= 0) {
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+/*
+ * Read and close the counters, scaling up any that the kernel had to share
+ * the PMU for, into counts in the order of command_events.
+ */
+static void close_command_counters(int *fds, double *counts)
+{
+	uint64_t value[3];	/* value, time enabled, time running */
+	int i;
+
+	for (i = 0; i < NUM_COMMAND_EVENTS; i++) {
+		counts[i] = -1.0;
+		if (fds[i] < 0) {
+			continue;
+		}
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fds[i], value, sizeof(value)) == sizeof(value)) {
+			counts[i] = value[0];
+			if (value[2] > 0 && value[2] < value[1]) {
+				counts[i] *= (double)value[1] / value[2];
+			}
+		}
+		close(fds[i]);
+	}
+}
+
+static double opt_timeval_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/*
+ * Somewhere in memory for the command's stdout to go, so that it can be
+ * any size without the child blocking on a full pipe while we wait for it.
+ */
+static int open_command_output(void)
+{
+	int fd = memfd_create("optsearch-output", MFD_CLOEXEC);
+	FILE *file = NULL;
+
+	if (fd < 0) {
+		/* Before Linux 3.17 */
+		file = tmpfile();
+		if (file != NULL) {
+			fd = dup(fileno(file));
+			fclose(file);
+		}
+	}
+	if (fd < 0) {
+		log_error("Unable to capture command output: %s",
+			  strerror(errno));
+	}
+	return fd;
+}
+
+/*
+ * Read back what the command wrote, passing it on to our own stdout as if
+ * it had not been captured, if echo is set.  Returns NULL if there was
+ * nothing.
+ */
+static char *read_command_output(int fd, bool echo)
+{
+	char *output = NULL;
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	if (size > 0 && (output = malloc(size + 1)) != NULL) {
+		if (pread(fd, output, size, 0) != size) {
+			log_error("Unable to read command output: %s",
+				  strerror(errno));
+			free(output);
+			return NULL;
+		}
+		output[size] = '\0';
+		if (echo) {
+			fwrite(output, 1, size, stdout);
+			fflush(stdout);
+		}
+	}
+	return output;
+}
+
+int run_command_usage(char *const argv[], char *const envp[],
+		      opt_command_usage_t * usage, int timeout)
+{
+	return run_command_capture(argv, envp, usage, NULL, timeout);
+}
+
+static int spawn_command(char *const argv[], char *const envp[],
+			 opt_command_usage_t * usage, char **output,
+			 bool echo, int timeout)
 {
 	pid_t cpid;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
 	double start_time, end_time;
-    siginfo_t info;
+	siginfo_t info;
+	struct rusage rusage;
+	int counters[NUM_COMMAND_EVENTS] = { -1, -1, -1 };
+	double counts[NUM_COMMAND_EVENTS];
+	int rc, output_fd = -1;
 
-	log_trace("Entered run_command function.");
-	
-	if (command == NULL) {
+	log_trace("Entered spawn_command function.");
+
+	memset(usage, 0, sizeof(*usage));
+	usage->cycles = usage->instructions = usage->task_clock = -1.0;
+	usage->status = -1;
+	if (output != NULL) {
+		*output = NULL;
+	}
+	if (argv == NULL || argv[0] == NULL) {
 		log_error("Cannot run NULL command");
+		usage->wall_time = DBL_MAX;
 		return (-1);
 	}
-	log_trace("run_command(): Attempting to fork child to run command %s with timeout %d", command, timeout);
+	log_trace("spawn_command(): Attempting to spawn %s with timeout %d",
+		  argv[0], timeout);
 
-	/* TODO
-	 * - Kill child if we receive the quit_signal.
-	 *      Less worrying as this process will get reaped along with any
-	 *      spawned children, but it would be nice to finish more cleanly.
-	 */
-	if ((cpid = vfork()) < 0) {
-		log_fatal("Unable to fork child process");
-		MPI_Abort(MPI_COMM_WORLD, -1);
+	posix_spawn_file_actions_init(&actions);
+	if (output != NULL) {
+		output_fd = open_command_output();
+		if (output_fd < 0) {
+			posix_spawn_file_actions_destroy(&actions);
+			usage->wall_time = DBL_MAX;
+			return (-1);
+		}
+		posix_spawn_file_actions_adddup2(&actions, output_fd,
+						 STDOUT_FILENO);
 	}
+
+	/* The child gets a process group of its own, so that waitid_timeout
+	 * can take out anything it starts along with it. */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
 	/* TODO
 	 * - Set child process's oom_adj score to 14 (the highest score
 	 *   possible is 15) so that it is likely to be reaped first if we run
 	 *   out of memory. (Manually, this is done by updating the value in
 	 *   /proc/$cpid/oom_adj)
 	 */
-	start_time = MPI_Wtime();
-	if (0 == cpid) {
-		/* We are the child */
-		setpgid(cpid, 0);
-		errno = 0;
-		/* exec the command */
-		/* This should not return  if successful */
-		execl(SHELL, "sh", "-c", command, NULL);
-		log_error("Error running command: %s", strerror(errno));
+	if (count_events) {
+		open_command_counters(counters);
+	}
+	start_time = opt_monotonic_time();
+	rc = posix_spawnp(&cpid, argv[0], &actions, &attr, argv,
+			  envp != NULL ? envp : environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (rc != 0) {
+		log_error("Error running command %s: %s", argv[0], strerror(rc));
+		close_command_counters(counters, counts);
+		if (output_fd >= 0) {
+			close(output_fd);
+		}
+		usage->wall_time = DBL_MAX;
+		return (-1);
+	}
+	if (command_pgid_record != NULL) {
+		*command_pgid_record = cpid;
 	}
 	/* waitid_timeout kills child process group if time limit exceeded
 	 *      ** This is important! **
 	 * Unfortunately, processes are quite likely to overrun or fail to
 	 * terminate if there is a compiler optimisation bug.
 	 */
-	if (waitid_timeout(command, cpid, &info, timeout) < 0) {
-		*time = DBL_MAX;
+	rc = waitid_timeout(argv[0], cpid, &info, &rusage, timeout);
+	end_time = opt_monotonic_time();
+	if (command_pgid_record != NULL) {
+		*command_pgid_record = 0;
+	}
+	close_command_counters(counters, counts);
+	if (output_fd >= 0) {
+		*output = read_command_output(output_fd, echo);
+		close(output_fd);
+	}
+	if ((rc == 0 || info.si_pid != 0)
+	    && (info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED)) {
+		usage->signal = info.si_status;
+		/* waitid_timeout only counts it a success if it killed it */
+		usage->timed_out = rc == 0;
+	}
+	if (rc < 0) {
+		usage->wall_time = DBL_MAX;
 		return (-1);
 	}
-	end_time = MPI_Wtime();
-	*time = end_time - start_time;
+	usage->wall_time = end_time - start_time;
+	usage->user_time = opt_timeval_seconds(&rusage.ru_utime);
+	usage->system_time = opt_timeval_seconds(&rusage.ru_stime);
+	usage->max_rss = rusage.ru_maxrss;
+	usage->cycles = counts[0];
+	usage->instructions = counts[1];
+	usage->task_clock = counts[2] >= 0.0 ? counts[2] / 1e9 : -1.0;
+	if (count_events) {
+		log_debug("run_command: Counted %.0lf cycles, %.0lf instructions and %lf s of task clock",
+			  usage->cycles, usage->instructions, usage->task_clock);
+	}
 
-	log_debug("run_command: Got status %d and duration %lf", info.si_status, *time);
+	log_debug("run_command: Got status %d and duration %lf (user %lf, system %lf, max RSS %ld KiB)",
+		  info.si_status, usage->wall_time, usage->user_time,
+		  usage->system_time, usage->max_rss);
 
 	if (info.si_code == CLD_EXITED) {
+		usage->status = info.si_status;
 		return info.si_status;
 	} else if (info.si_code == CLD_KILLED) {
 		log_info("Spawned child process was terminated by signal");
@@ -284,6 +990,139 @@ int run_command(const char *command, double *time, int timeout)
 	return -1;
 }
 
+int run_command_capture(char *const argv[], char *const envp[],
+			opt_command_usage_t * usage, char **output,
+			int timeout)
+{
+	return spawn_command(argv, envp, usage, output, true, timeout);
+}
+
+int run_command_query(char *const argv[], char **output, int timeout)
+{
+	opt_command_usage_t usage;
+
+	return spawn_command(argv, NULL, &usage, output, false, timeout);
+}
+
+int run_command_argv(char *const argv[], char *const envp[], double *time,
+		     int timeout)
+{
+	opt_command_usage_t usage;
+	int rc;
+
+	rc = run_command_usage(argv, envp, &usage, timeout);
+	*time = usage.wall_time;
+	return rc;
+}
+
+int run_command(const char *command, double *time, int timeout)
+{
+	char *argv[] = { SHELL, "-c", NULL, NULL };
+
+	/* TODO
+	 * - Kill child if we receive the quit_signal.
+	 *      Less worrying as this process will get reaped along with any
+	 *      spawned children, but it would be nice to finish more cleanly.
+	 */
+	if (command == NULL) {
+		log_error("Cannot run NULL command");
+		return (-1);
+	}
+	log_trace("run_command(): Running %s with timeout %d", command, timeout);
+	argv[2] = (char *)command;
+	return run_command_argv(argv, NULL, time, timeout);
+}
+
+/* Characters that mean a command needs the shell to make sense of it */
+#define SHELL_SYNTAX "|&;<>()$`\\*?[]#~!\n"
+
+char **split_command(const char *command)
+{
+	char **argv = NULL;
+	char *words = NULL;
+	char *out = NULL;
+	const char *in = NULL;
+	char quote = '\0';
+	int argc = 0;
+	bool in_word = false;
+	size_t len;
+
+	if (command == NULL) {
+		return NULL;
+	}
+	len = strlen(command);
+	/* No command can have more words than half its length, plus the three
+	 * we might need for the shell and one for the NULL. */
+	argv = malloc((len / 2 + 4) * sizeof(*argv));
+	words = malloc(len + strlen(SHELL) + 5);
+	if (argv == NULL || words == NULL) {
+		free(argv);
+		free(words);
+		return NULL;
+	}
+
+	out = words;
+	for (in = command; *in != '\0'; in++) {
+		if (quote == '\0' && strchr(SHELL_SYNTAX, *in) != NULL) {
+			break;
+		}
+		if (quote == '\0' && argc == 1 && in_word && *in == '=') {
+			/* A variable assignment, eg FOO=bar ./build.sh */
+			break;
+		}
+		if (*in == quote) {
+			quote = '\0';
+		} else if (quote == '\0' && (*in == '\'' || *in == '"')) {
+			quote = *in;
+			if (!in_word) {
+				argv[argc++] = out;
+				in_word = true;
+			}
+		} else if (quote == '\0' && (*in == ' ' || *in == '\t')) {
+			if (in_word) {
+				*out++ = '\0';
+				in_word = false;
+			}
+		} else {
+			if (quote == '"' && strchr("$`\\!", *in) != NULL) {
+				break;
+			}
+			if (!in_word) {
+				argv[argc++] = out;
+				in_word = true;
+			}
+			*out++ = *in;
+		}
+	}
+
+	if (*in != '\0' || quote != '\0' || argc == 0) {
+		/* Leave it to the shell */
+		out = words;
+		strcpy(out, SHELL);
+		argv[0] = out;
+		out += strlen(SHELL) + 1;
+		strcpy(out, "-c");
+		argv[1] = out;
+		out += 3;
+		strcpy(out, command);
+		argv[2] = out;
+		argc = 3;
+	} else if (in_word) {
+		*out = '\0';
+	}
+	argv[argc] = NULL;
+	return argv;
+}
+
+void free_command(char **argv)
+{
+	if (argv != NULL) {
+		/* All the words are in the one allocation, starting with the first */
+		free(argv[0]);
+		free(argv);
+	}
+}
+
 int opt_get_signum(char *signame)
 {
 	if (signame == NULL) {
@@ -33,15 +33,31 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <libgen.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <glob.h>
+#include <elf.h>
 #include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <math.h>
 #include <limits.h>
 #include <float.h>
 #include <features.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include <linux/perf_event.h>
 
 #include <mpi.h>
 
@@ -107,8 +123,22 @@ extern int waitpid_timeout(const char *name, pid_t pid, int *pstatus,
 			   int timeout);
 
 /**
- * Uses waitpid_timeout to run a command, returning the runtime of that
- * command as measured using calls to MPI_Wtime().
+ * Register a function for run_command to call every second or so while it
+ * waits for the command to finish, eg so a worker can tell the master that
+ * it is still alive during a long build.  Pass NULL to remove it.
+ */
+void set_child_wait_hook(void (*hook) (void));
+
+/**
+ * Have run_command keep the process group of the command it is running in
+ * *record, or 0 when there is none, eg in memory shared with a parent that
+ * may need to kill it.  Pass NULL to stop.
+ */
+void set_command_pgid_record(volatile pid_t * record);
+
+/**
+ * Uses waitid_timeout to run a command, returning the runtime of that
+ * command as measured by CLOCK_MONOTONIC.
  *
  * @param command the command to run
  * @param exec_time where to store the execution time
@@ -117,6 +147,152 @@ extern int waitpid_timeout(const char *name, pid_t pid, int *pstatus,
  */
 int run_command(const char *command, double *exec_time, int timeout);
 
+/**
+ * What run_command_usage measured of a command.
+ */
+typedef struct {
+	double wall_time; /** Seconds from spawn to reap, by CLOCK_MONOTONIC */
+	double user_time; /** CPU seconds in user mode, children included */
+	double system_time; /** CPU seconds in the kernel, children included */
+	long max_rss; /** Largest resident set size of any of them, in KiB */
+	/** User space counts from perf_event_open(2), with task_clock in
+	 * seconds, if set_command_counters turned them on; -1 if not counted */
+	double cycles;
+	double instructions;
+	double task_clock;
+	int status; /** The command's exit status, or -1 if it did not exit */
+	int signal; /** The signal that ended it, or 0 */
+	bool timed_out; /** Killed for running past its timeout */
+} opt_command_usage_t;
+
+/**
+ * Turn on or off counting cycles, instructions and task clock for the
+ * commands run_command_usage runs after this, eg just for the benchmark.
+ * Any counter the kernel or hardware will not give us is reported as -1.
+ */
+void set_command_counters(bool enable);
+
+/**
+ * Seconds since some fixed point, from CLOCK_MONOTONIC, for timing things
+ * without being thrown by changes to the system clock.
+ */
+double opt_monotonic_time(void);
+
+/**
+ * How busy the node is, for telling whether it is quiet enough to
+ * benchmark on.  Anything that cannot be read is -1.
+ */
+typedef struct {
+	double load; /** One-minute load average, from /proc/loadavg */
+	double busy; /** Percentage of CPU time not idle, from /proc/stat */
+	double freq; /** Mean of each CPU's scaling_cur_freq, in MHz */
+} opt_node_noise_t;
+
+/**
+ * Sample the node's noise, with busy measured over the given number of
+ * seconds, for which this sleeps.
+ */
+void sample_node_noise(opt_node_noise_t * noise, double interval);
+
+/** The starting value for hash_bytes (the FNV-1a 64-bit offset basis) */
+#define OPT_HASH_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Add size bytes at data to a running 64-bit FNV-1a hash, begun with
+ * OPT_HASH_INIT.  This is for telling builds apart, not for security.
+ */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+
+/**
+ * Add everything under dir to a running hash: the path of each entry
+ * relative to dir, in sorted order, and the contents of each file or the
+ * target of each symbolic link.  Timestamps, owners and permissions are
+ * left out, so that an unchanged tree hashes the same wherever it is.
+ *
+ * @return 0 on success, else -1 if anything could not be read
+ */
+int hash_tree(const char *dir, uint64_t * hash);
+
+/**
+ * Add the files matching any of the space-separated glob(3) patterns to a
+ * running hash, as hash_tree does, so that two builds producing the same
+ * code hash the same.  To that end, what a build stamps on its output is
+ * left out: the build ID of an ELF file, and the timestamps, owners and
+ * permissions of the members of an ar(1) archive.  Anything else that
+ * differs between builds (eg __DATE__) still changes the hash.
+ *
+ * @return the number of files hashed, or -1 if any could not be read
+ */
+int hash_build_files(const char *patterns, uint64_t * hash);
+
+/**
+ * As run_command_argv, but recording the CPU time and memory the command
+ * used as well as how long it took.
+ *
+ * @param argv the command and its arguments, ending in NULL
+ * @param envp the environment to give it, or NULL to pass on our own
+ * @param usage where to store what was measured; wall_time is DBL_MAX if
+ *        it could not be run
+ * @param timeout the timeout to use
+ * @return -1 on failure, else the return value of the command
+ */
+int run_command_usage(char *const argv[], char *const envp[],
+		      opt_command_usage_t * usage, int timeout);
+
+/**
+ * As run_command_usage, but capturing what the command writes to stdout in
+ * memory, which is also passed on to our own stdout once it has finished.
+ *
+ * @param output where to store the output, to be freed by the caller; NULL
+ *        if there was none
+ * @return -1 on failure, else the return value of the command
+ */
+int run_command_capture(char *const argv[], char *const envp[],
+			opt_command_usage_t * usage, char **output,
+			int timeout);
+
+/**
+ * As run_command_capture, but for a command run to find something out
+ * rather than as part of an evaluation, so its output is not passed on.
+ *
+ * @param argv the command and its arguments, ending in NULL
+ * @param output where to store the output, to be freed by the caller; NULL
+ *        if there was none
+ * @param timeout the timeout to use
+ * @return -1 on failure, else the return value of the command
+ */
+int run_command_query(char *const argv[], char **output, int timeout);
+
+/**
+ * As run_command, but with no shell in between: argv[0] is found on the
+ * PATH and spawned with posix_spawnp(3) in a process group of its own.
+ *
+ * @param argv the command and its arguments, ending in NULL
+ * @param envp the environment to give it, or NULL to pass on our own
+ * @param exec_time where to store the execution time
+ * @param timeout the timeout to use
+ * @return -1 on failure, else the return value of the command
+ */
+int run_command_argv(char *const argv[], char *const envp[],
+		     double *exec_time, int timeout);
+
+/**
+ * Split a command as given in the config into arguments for
+ * run_command_argv, the way the shell would a simple command: on spaces
+ * and tabs, with single or double quotes keeping a word together.  If the
+ * command uses anything more (pipes, redirection, variables, globs and so
+ * on), the result is instead SHELL -c command, so that it still works.
+ *
+ * @param command the command to split
+ * @return a NULL terminated array to release with free_command, or NULL
+ */
+char **split_command(const char *command);
+
+/**
+ * Free what split_command returned.
+ */
+void free_command(char **argv);
+
 /**
  * Take a signal name from the small set that is valid for use with eg SLURM,
  * and convert it to the corresponding value (as per signal(7)).  Either the
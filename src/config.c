@@ -134,6 +134,7 @@ opt_flag_t *new_list_flag(const char *name, const char *prefix,
 	flag->data.list.values = values;
 	flag->data.list.size = num_values;
 	flag->data.list.value = 0;
+	flag->default_value = NULL;
 	return flag;
 }
 
@@ -146,6 +147,7 @@ opt_flag_t *new_onoff_flag(const char *name, const char *prefix,
 	flag->type = OPT_ONOFF_FLAG;
 	flag->prefix = prefix;
 	flag->data.onoff.neg_prefix = neg_prefix;
+	flag->default_value = NULL;
 	return flag;
 }
 
@@ -176,6 +178,7 @@ opt_flag_t *new_range_flag(const char *name, const char *prefix,
 	}
 	flag->data.range.min = min;
 	flag->data.range.value = min;
+	flag->default_value = NULL;
 	return flag;
 }
 
@@ -201,6 +204,65 @@ enum option_attr_t {
 	OA_DEPENDED_ON_BY = 'D',
 };
 
+/*
+ * YAML booleans may be written in several ways; anything we do not
+ * recognise as true is false.
+ */
+static bool opt_parse_bool(const char *value)
+{
+	return !strcasecmp(value, "true") || !strcasecmp(value, "yes")
+	    || !strcasecmp(value, "on") || !strcmp(value, "1");
+}
+
+static opt_scheduler_t opt_parse_scheduler(const char *value)
+{
+	if (!strcmp(value, "best-first")) {
+		return OPT_SCHEDULER_BEST_FIRST;
+	} else if (!strcmp(value, "cost-aware")) {
+		return OPT_SCHEDULER_COST_AWARE;
+	} else if (strcmp(value, "fifo")) {
+		log_error("Unrecognised scheduler '%s', using fifo", value);
+	}
+	return OPT_SCHEDULER_FIFO;
+}
+
+static opt_fitness_metric_t opt_parse_fitness_metric(const char *value)
+{
+	if (!strcmp(value, "cpu-time")) {
+		return OPT_METRIC_CPU_TIME;
+	} else if (!strcmp(value, "user-time")) {
+		return OPT_METRIC_USER_TIME;
+	} else if (!strcmp(value, "max-rss")) {
+		return OPT_METRIC_MAX_RSS;
+	} else if (!strcmp(value, "cycles")) {
+		return OPT_METRIC_CYCLES;
+	} else if (!strcmp(value, "instructions")) {
+		return OPT_METRIC_INSTRUCTIONS;
+	} else if (!strcmp(value, "task-clock")) {
+		return OPT_METRIC_TASK_CLOCK;
+	} else if (strcmp(value, "wall-time")) {
+		log_error("Unrecognised fitness metric '%s', using wall-time",
+			  value);
+	}
+	return OPT_METRIC_WALL_TIME;
+}
+
+static opt_aggregate_t opt_parse_aggregate(const char *value)
+{
+	if (!strcmp(value, "median")) {
+		return OPT_AGGREGATE_MEDIAN;
+	} else if (!strcmp(value, "min")) {
+		return OPT_AGGREGATE_MIN;
+	} else if (!strcmp(value, "trimmed-mean")) {
+		return OPT_AGGREGATE_TRIMMED_MEAN;
+	} else if (!strcmp(value, "mad")) {
+		return OPT_AGGREGATE_MAD;
+	} else if (strcmp(value, "mean")) {
+		log_error("Unrecognised aggregate '%s', using mean", value);
+	}
+	return OPT_AGGREGATE_MEAN;
+}
+
 int is_map(enum parser_state_t state)
 {
 	return state == S_TOP_LEVEL_MAP ||
@@ -232,6 +294,34 @@ int read_config(const char *yaml_file, opt_config_t * config)
     config->timeout = 120;
     config->benchmark_timeout = 120;
     config->benchmark_repeats = 20;
+	config->benchmark_warmup = 0;
+	config->quiet_threshold = 0.0;
+	config->quiet_wait = 30;
+	config->benchmark_timeout_factor = 4.0;
+	config->build_timeout_percentile = 99;
+	config->fitness_metric = OPT_METRIC_WALL_TIME;
+	config->aggregate = OPT_AGGREGATE_MEAN;
+	config->fitness_pattern = NULL;
+	config->fitness_key = NULL;
+	config->maximise = false;
+	config->racing = false;
+	config->race_confidence = 0.95;
+	config->exclusive_benchmark = false;
+	config->benchmark_workers = 0;
+	config->artifact_dir = NULL;
+	config->staging_dir = NULL;
+	config->source_dir = NULL;
+	config->build_cache = NULL;
+	config->shared_build_cache = NULL;
+	config->artifact_glob = NULL;
+	config->effective_flags = NULL;
+	config->scheduler = OPT_SCHEDULER_FIFO;
+	config->speculative = false;
+	config->heartbeat_interval = 30;
+	config->local_slots = 0;
+	config->slots_per_worker = 1;
+	config->pin_slots = false;
+	config->slot_numa = false;
 	config->num_flags = 0;
 	config->compiler_flags = NULL;
 
@@ -320,6 +410,63 @@ int read_config(const char *yaml_file, opt_config_t * config)
 							config->benchmark_timeout = atof(scalar_value);	/* TODO Check validity */
 						} else if (!strcmp (map_key, "benchmark-repeats")) {
 							config->benchmark_repeats = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "benchmark-warmup")) {
+							config->benchmark_warmup = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "quiet-threshold")) {
+							config->quiet_threshold = atof(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "quiet-wait")) {
+							config->quiet_wait = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "benchmark-timeout-factor")) {
+							config->benchmark_timeout_factor = atof(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "build-timeout-percentile")) {
+							config->build_timeout_percentile = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "fitness-metric")) {
+							config->fitness_metric = opt_parse_fitness_metric(scalar_value);
+						} else if (!strcmp (map_key, "benchmark-aggregate")) {
+							config->aggregate = opt_parse_aggregate(scalar_value);
+						} else if (!strcmp (map_key, "fitness-pattern")) {
+							config->fitness_pattern = strdup(scalar_value);
+						} else if (!strcmp (map_key, "fitness-key")) {
+							config->fitness_key = strdup(scalar_value);
+						} else if (!strcmp (map_key, "maximise")
+							   || !strcmp (map_key, "maximize")) {
+							config->maximise = opt_parse_bool(scalar_value);
+						} else if (!strcmp (map_key, "racing")) {
+							config->racing = opt_parse_bool(scalar_value);
+						} else if (!strcmp (map_key, "race-confidence")) {
+							config->race_confidence = atof(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "exclusive-benchmark")) {
+							config->exclusive_benchmark = opt_parse_bool(scalar_value);
+						} else if (!strcmp (map_key, "benchmark-workers")) {
+							config->benchmark_workers = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "artifact-dir")) {
+							config->artifact_dir = strdup(scalar_value);
+						} else if (!strcmp (map_key, "staging-dir")) {
+							config->staging_dir = strdup(scalar_value);
+						} else if (!strcmp (map_key, "source-dir")) {
+							config->source_dir = strdup(scalar_value);
+						} else if (!strcmp (map_key, "build-cache")) {
+							config->build_cache = strdup(scalar_value);
+						} else if (!strcmp (map_key, "shared-build-cache")) {
+							config->shared_build_cache = strdup(scalar_value);
+						} else if (!strcmp (map_key, "artifact-glob")) {
+							config->artifact_glob = strdup(scalar_value);
+						} else if (!strcmp (map_key, "effective-flags")) {
+							config->effective_flags = strdup(scalar_value);
+						} else if (!strcmp (map_key, "scheduler")) {
+							config->scheduler = opt_parse_scheduler(scalar_value);
+						} else if (!strcmp (map_key, "speculative")) {
+							config->speculative = opt_parse_bool(scalar_value);
+						} else if (!strcmp (map_key, "heartbeat-interval")) {
+							config->heartbeat_interval = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "local-slots")) {
+							config->local_slots = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "slots-per-worker")) {
+							config->slots_per_worker = atoi(scalar_value);	/* TODO Check validity */
+						} else if (!strcmp (map_key, "pin-slots")) {
+							config->pin_slots = opt_parse_bool(scalar_value);
+						} else if (!strcmp (map_key, "slot-numa")) {
+							config->slot_numa = opt_parse_bool(scalar_value);
 						} else {
 							log_error
 							    ("Encountered invalid map key in top-level of config: %s='%s'",
@@ -456,6 +603,13 @@ int read_config(const char *yaml_file, opt_config_t * config)
 								     map_key,
 								     scalar_value);
 							}
+						} else
+						    if (!strcmp
+							(map_key, "default")) {
+							flag_buffer->
+							    default_value =
+							    strdup
+							    (scalar_value);
 						} else
 						    if (!strcmp(map_key, "max"))
 						{
@@ -687,38 +841,207 @@ opt_config_t * opt_new_config(void)
 	config->accuracy_test = NULL;
 	config->benchmark_timeout = 0;
 	config->benchmark_repeats = 0;
+	config->benchmark_warmup = 0;
+	config->quiet_threshold = 0.0;
+	config->quiet_wait = 0;
 	config->epsilon = 0.0;
+	config->benchmark_timeout_factor = 0.0;
+	config->build_timeout_percentile = 0;
 	config->perf_test = NULL;
+	config->fitness_metric = OPT_METRIC_WALL_TIME;
+	config->aggregate = OPT_AGGREGATE_MEAN;
+	config->fitness_pattern = NULL;
+	config->fitness_key = NULL;
+	config->maximise = false;
+	config->racing = false;
+	config->race_confidence = 0.0;
+	config->exclusive_benchmark = false;
+	config->benchmark_workers = 0;
+	config->artifact_dir = NULL;
+	config->staging_dir = NULL;
+	config->source_dir = NULL;
+	config->build_cache = NULL;
+	config->shared_build_cache = NULL;
+	config->artifact_glob = NULL;
+	config->effective_flags = NULL;
+	config->scheduler = OPT_SCHEDULER_FIFO;
+	config->speculative = false;
+	config->heartbeat_interval = 0;
+	config->local_slots = 0;
+	config->slots_per_worker = 1;
+	config->pin_slots = false;
+	config->slot_numa = false;
 	return config;
 }
 
-int opt_bcast_string(int root, char * string)
+int opt_bcast_string(int root, char ** string)
 {
 	int rc, my_rank, len = 0;
 
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
 	if (root == my_rank) {
-		if (string == NULL) {
+		if (*string == NULL) {
 			log_fatal("Cannot send NULL string to workers");
 			MPI_Abort(MPI_COMM_WORLD, -1);
 		}
-		len = strlen(string);
+		len = strlen(*string);
 	}
 	MPI_Bcast(&len, 1, MPI_INT, root, MPI_COMM_WORLD);
-	len = len;
 	log_debug("len is %d", len);
-	if (MASTER != my_rank) {
-		string = realloc(string, (len+1) * sizeof(char));
-		string[len] = '\0';
+	if (root != my_rank) {
+		/* The caller's copy moves with it */
+		*string = realloc(*string, (len+1) * sizeof(char));
+		(*string)[len] = '\0';
 	}
-	rc = MPI_Bcast(string, len, MPI_CHAR, root, MPI_COMM_WORLD);
-	log_debug("String post-broadcast: %s", string);
+	rc = MPI_Bcast(*string, len, MPI_CHAR, root, MPI_COMM_WORLD);
+	log_debug("String post-broadcast: %s", *string);
 	return rc;
 }
 
+/*
+ * Broadcast a string that may be NULL, returning the root's pointer on the
+ * root and a newly allocated copy everywhere else.
+ */
+static char *opt_bcast_new_string(int root, const char *string)
+{
+	int my_rank, len = -1;
+	char *copy = NULL;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	if (root == my_rank && string != NULL) {
+		len = strlen(string);
+	}
+	MPI_Bcast(&len, 1, MPI_INT, root, MPI_COMM_WORLD);
+	if (len < 0) {
+		return NULL;
+	}
+	if (root == my_rank) {
+		copy = (char *)string;
+	} else {
+		copy = malloc((len + 1) * sizeof(char));
+		if (copy == NULL) {
+			log_fatal("Unable to allocate memory for broadcast string");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		copy[len] = '\0';
+	}
+	MPI_Bcast(copy, len, MPI_CHAR, root, MPI_COMM_WORLD);
+	return copy;
+}
+
+/*
+ * Broadcast the flag table, so that workers can turn positions into flags
+ * themselves.  Everything is sent with the root's values, including the uid,
+ * so the flags are identical on every rank.
+ */
+static void opt_share_flags(int root, opt_config_t * config)
+{
+	int i, j, my_rank;
+	int ints[5];
+	opt_flag_t *flag = NULL;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+
+	MPI_Bcast(&(config->num_flags), 1, MPI_INT, root, MPI_COMM_WORLD);
+	if (root != my_rank) {
+		config->compiler_flags = NULL;
+		if (config->num_flags > 0) {
+			config->compiler_flags =
+			    malloc(config->num_flags *
+				   sizeof(*config->compiler_flags));
+			if (config->compiler_flags == NULL) {
+				log_fatal
+				    ("Unable to allocate memory for compiler flags");
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+		}
+	}
+
+	for (i = 0; i < config->num_flags; i++) {
+		if (root == my_rank) {
+			flag = config->compiler_flags[i];
+			ints[0] = flag->type;
+			ints[1] = flag->uid;
+			switch (flag->type) {
+			case OPT_RANGE_FLAG:
+				ints[2] = flag->data.range.max;
+				ints[3] = flag->data.range.min;
+				ints[4] = flag->data.range.value;
+				break;
+			case OPT_LIST_FLAG:
+				ints[2] = flag->data.list.size;
+				ints[3] = flag->data.list.value;
+				break;
+			default:
+				break;
+			}
+		} else {
+			flag = calloc(1, sizeof(*flag));
+			if (flag == NULL) {
+				log_fatal
+				    ("Unable to allocate memory for compiler flag");
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+			config->compiler_flags[i] = flag;
+		}
+		MPI_Bcast(ints, 5, MPI_INT, root, MPI_COMM_WORLD);
+		flag->type = ints[0];
+		flag->uid = ints[1];
+		flag->name = opt_bcast_new_string(root, flag->name);
+		flag->prefix = opt_bcast_new_string(root, flag->prefix);
+		flag->default_value =
+		    opt_bcast_new_string(root, flag->default_value);
+
+		switch (flag->type) {
+		case OPT_RANGE_FLAG:
+			flag->data.range.max = ints[2];
+			flag->data.range.min = ints[3];
+			flag->data.range.value = ints[4];
+			flag->data.range.separator =
+			    opt_bcast_new_string(root,
+						 flag->data.range.separator);
+			break;
+		case OPT_LIST_FLAG:
+			flag->data.list.size = ints[2];
+			flag->data.list.value = ints[3];
+			flag->data.list.separator =
+			    opt_bcast_new_string(root,
+						 flag->data.list.separator);
+			if (root != my_rank) {
+				flag->data.list.values =
+				    malloc(flag->data.list.size *
+					   sizeof(*flag->data.list.values));
+				if (flag->data.list.values == NULL) {
+					log_fatal
+					    ("Unable to allocate memory for compiler flag values");
+					MPI_Abort(MPI_COMM_WORLD, -1);
+				}
+				for (j = 0; j < flag->data.list.size; j++) {
+					flag->data.list.values[j] = NULL;
+				}
+			}
+			for (j = 0; j < flag->data.list.size; j++) {
+				flag->data.list.values[j] =
+				    opt_bcast_new_string(root,
+							 flag->data.list.
+							 values[j]);
+			}
+			break;
+		case OPT_ONOFF_FLAG:
+			flag->data.onoff.neg_prefix =
+			    opt_bcast_new_string(root,
+						 flag->data.onoff.neg_prefix);
+			break;
+		default:
+			break;
+		}
+	}
+	log_debug("Got %d compiler flags", config->num_flags);
+}
+
 int opt_share_config(int root, opt_config_t * config)
 {
-	int my_rank;
+	int my_rank, flag;
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
 
 	if (config == NULL) {
@@ -726,44 +1049,97 @@ int opt_share_config(int root, opt_config_t * config)
 		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
 
-	/* MPI_Bcast each part of the config in turn, except for the flags
-	 * and the compiler name/version, which the workers do not need.  Lots of
-	 * small broadcasts like this is inefficient, but we only do it once per
-	 * run, so it should not matter.
+	/* MPI_Bcast each part of the config in turn.  Lots of small broadcasts
+	 * like this is inefficient, but we only do it once per run, so it should
+	 * not matter.
 	 */
 
 	MPI_Bcast(&(config->timeout), 1, MPI_INT, root, MPI_COMM_WORLD);
 	if (root != my_rank)
 		config->quit_signal = strdup("");
-	opt_bcast_string(root, config->quit_signal);
+	opt_bcast_string(root, &config->quit_signal);
 	log_debug("Got quit signal: %s", config->quit_signal);
 	if (root != my_rank)
 		config->clean_script = strdup("");
-	opt_bcast_string(root, config->clean_script);
+	opt_bcast_string(root, &config->clean_script);
 	log_debug("Got clean script: %s", config->clean_script);
 	if (root != my_rank)
 		config->build_script = strdup("");
-	opt_bcast_string(root, config->build_script);
+	opt_bcast_string(root, &config->build_script);
 	log_debug("Got build script: %s", config->build_script);
 	if (root != my_rank)
 		config->accuracy_test = strdup("");
-	opt_bcast_string(root, config->accuracy_test);
+	opt_bcast_string(root, &config->accuracy_test);
 	log_debug("Got test script: %s", config->accuracy_test);
 
 	MPI_Bcast(&(config->benchmark_timeout), 1, MPI_INT, root, MPI_COMM_WORLD);
 	MPI_Bcast(&(config->benchmark_repeats), 1, MPI_INT, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->benchmark_warmup), 1, MPI_INT, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->quiet_threshold), 1, MPI_DOUBLE, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->quiet_wait), 1, MPI_INT, root, MPI_COMM_WORLD);
 	MPI_Bcast(&(config->epsilon), 1, MPI_DOUBLE, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->benchmark_timeout_factor), 1, MPI_DOUBLE, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->build_timeout_percentile), 1, MPI_INT, root, MPI_COMM_WORLD);
+	flag = config->fitness_metric;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->fitness_metric = flag;
+	flag = config->aggregate;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->aggregate = flag;
+	flag = config->maximise;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->maximise = flag;
+	flag = config->racing;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->racing = flag;
+	MPI_Bcast(&(config->race_confidence), 1, MPI_DOUBLE, root, MPI_COMM_WORLD);
+	flag = config->exclusive_benchmark;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->exclusive_benchmark = flag;
+	MPI_Bcast(&(config->benchmark_workers), 1, MPI_INT, root, MPI_COMM_WORLD);
+	flag = config->scheduler;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->scheduler = flag;
+	flag = config->speculative;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->speculative = flag;
+	MPI_Bcast(&(config->heartbeat_interval), 1, MPI_INT, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->local_slots), 1, MPI_INT, root, MPI_COMM_WORLD);
+	MPI_Bcast(&(config->slots_per_worker), 1, MPI_INT, root, MPI_COMM_WORLD);
+	flag = config->pin_slots;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->pin_slots = flag;
+	flag = config->slot_numa;
+	MPI_Bcast(&flag, 1, MPI_INT, root, MPI_COMM_WORLD);
+	config->slot_numa = flag;
+	/* These are optional, so may be NULL */
+	config->artifact_dir = opt_bcast_new_string(root, config->artifact_dir);
+	config->staging_dir = opt_bcast_new_string(root, config->staging_dir);
+	config->source_dir = opt_bcast_new_string(root, config->source_dir);
+	config->build_cache = opt_bcast_new_string(root, config->build_cache);
+	config->shared_build_cache =
+	    opt_bcast_new_string(root, config->shared_build_cache);
+	config->artifact_glob = opt_bcast_new_string(root, config->artifact_glob);
+	config->effective_flags =
+	    opt_bcast_new_string(root, config->effective_flags);
+	config->fitness_pattern =
+	    opt_bcast_new_string(root, config->fitness_pattern);
+	config->fitness_key = opt_bcast_new_string(root, config->fitness_key);
 	if (root != my_rank)
 		config->perf_test = strdup("");
-	opt_bcast_string(root, config->perf_test);
+	opt_bcast_string(root, &config->perf_test);
 	log_debug("Got benchmark script: %s", config->perf_test);
 
 	if (root != my_rank)
 		config->compiler = strdup("");
-	opt_bcast_string(root, config->compiler);
+	opt_bcast_string(root, &config->compiler);
 	if (root != my_rank)
 		config->compiler_version = strdup("");
-	opt_bcast_string(root, config->compiler_version);
+	opt_bcast_string(root, &config->compiler_version);
+
+	/* Workers need the flags to turn the positions they are sent into
+	 * FLAGS for the scripts */
+	opt_share_flags(root, config);
 	/* TODO Some more useful diagnostics would be nice here */
 	return 0;
 }
@@ -808,6 +1184,42 @@ void opt_clean_config(opt_config_t * config)
 		free(config->perf_test);
 		config->perf_test = NULL;
 	}
+	if (config->artifact_dir != NULL) {
+		free(config->artifact_dir);
+		config->artifact_dir = NULL;
+	}
+	if (config->staging_dir != NULL) {
+		free(config->staging_dir);
+		config->staging_dir = NULL;
+	}
+	if (config->source_dir != NULL) {
+		free(config->source_dir);
+		config->source_dir = NULL;
+	}
+	if (config->build_cache != NULL) {
+		free(config->build_cache);
+		config->build_cache = NULL;
+	}
+	if (config->shared_build_cache != NULL) {
+		free(config->shared_build_cache);
+		config->shared_build_cache = NULL;
+	}
+	if (config->artifact_glob != NULL) {
+		free(config->artifact_glob);
+		config->artifact_glob = NULL;
+	}
+	if (config->effective_flags != NULL) {
+		free(config->effective_flags);
+		config->effective_flags = NULL;
+	}
+	if (config->fitness_pattern != NULL) {
+		free(config->fitness_pattern);
+		config->fitness_pattern = NULL;
+	}
+	if (config->fitness_key != NULL) {
+		free(config->fitness_key);
+		config->fitness_key = NULL;
+	}
 }
 
 void opt_destroy_config(opt_config_t * config)
@@ -855,3 +1267,228 @@ void opt_destroy_flag(opt_flag_t * flag)
 	flag->name = NULL; */
 	free(flag);
 }
+
+opt_flag_t *opt_config_get_flag(opt_config_t * config, opt_flag_uid uid)
+{
+	int i;
+
+	if (config == NULL || config->compiler_flags == NULL) {
+		return NULL;
+	}
+	/* Flag uids are normally their index, so try that first */
+	if (uid >= 0 && uid < config->num_flags
+	    && config->compiler_flags[uid]->uid == uid) {
+		return config->compiler_flags[uid];
+	}
+	for (i = 0; i < config->num_flags; i++) {
+		if (config->compiler_flags[i]->uid == uid) {
+			return config->compiler_flags[i];
+		}
+	}
+	return NULL;
+}
+
+char *opt_flag_to_string(const opt_flag_t * flag, int value)
+{
+	/* this might be gcc specific due to the flag_format */
+	const char *EMPTY = "";
+	char *string = NULL;
+	int flag_size = 0;
+	char *flag_format;
+	int extra_chars;	/* The additional number of chars added by the formatting */
+
+	if (flag == NULL) {
+		log_error
+		    ("Unrecognised flag UID, could not convert dimension to corresponding compiler flag.");
+		return NULL;
+	}
+
+	log_debug
+	    ("config.c: flag->uid: %d, flag->name: %s, flag->prefix: %s",
+	     flag->uid, flag->name, flag->prefix);
+
+	switch (flag->type) {
+	case OPT_RANGE_FLAG:
+		if (value > flag->data.range.max
+		    || value < flag->data.range.min) {
+			log_debug
+			    ("config.c: dim value (%d) is out of range",
+			     value);
+			string = strdup(EMPTY);
+			break;
+		}
+		if (flag->data.range.separator == NULL) {
+			log_error
+			    ("Check your YAML.  This flag is invalid (%s) as it has no separator.",
+			     flag->name);
+			string = strdup(EMPTY);
+			break;
+		}
+		flag_format = "%s%s%s%d";
+		extra_chars = strlen(flag_format);
+		flag_size =
+		    strlen(flag->name) + strlen(flag->prefix) +
+		    strlen(flag->data.range.separator) + CHAR_INT_MAX;
+		string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
+		sprintf(string, flag_format, flag->prefix, flag->name,
+			flag->data.range.separator, value);
+		break;
+	case OPT_LIST_FLAG:
+		if (value >= flag->data.list.size || value < 0) {
+			log_debug
+			    ("config.c: dim->value (%d) is out of range",
+			     value);
+			string = strdup(EMPTY);
+			break;
+		}
+		flag_format = "%s%s%s%s";
+		extra_chars = strlen(flag_format);
+		flag_size =
+		    strlen(flag->name) + strlen(flag->prefix) +
+		    strlen(flag->data.list.separator) +
+		    strlen(flag->data.list.values[value]);
+		string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
+		sprintf(string, flag_format, flag->prefix, flag->name,
+			flag->data.list.separator,
+			flag->data.list.values[value]);
+		break;
+	case OPT_ONOFF_FLAG:
+		flag_format = "%s%s";
+		extra_chars = strlen(flag_format);
+		/* TODO Need to check if prefix is bigger than neg_prefix, but
+		 * with GCC it isn't. Also the format might be a bit different */
+		if (value == 1) {
+			flag_size = strlen(flag->name) + strlen(flag->prefix);
+			string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
+			sprintf(string, flag_format, flag->prefix, flag->name);
+		} else if (value == 0) {
+			flag_size =
+			    strlen(flag->name) +
+			    strlen(flag->data.onoff.neg_prefix);
+			string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
+			sprintf(string, flag_format,
+				flag->data.onoff.neg_prefix, flag->name);
+		} else {
+			log_debug
+			    ("config.c: dim->value (%d) is out of range",
+			     value);
+			string = strdup(EMPTY);
+		}
+		break;
+	default:
+		log_error
+		    ("Unrecognised flag type, could not convert dimension to compiler flag.");
+		return NULL;
+	}
+	log_debug("config.c: Flag string generated is: \"%s\"", string);
+
+	return string;
+}
+
+char *opt_flags_to_string(int num_flags, opt_flag_t ** flags,
+			  const int *values)
+{
+	int i;
+	char *options = NULL;
+	char *next_option = NULL;
+	int options_size = 0;
+
+	options = strdup("");	/* strlen will segfault on a NULL */
+	for (i = 0; i < num_flags; i++) {
+		next_option = opt_flag_to_string(flags[i], values[i]);
+		if (next_option == NULL) {
+			continue;
+		}
+		if (strcmp(next_option, "")) {
+			options_size =
+			    strlen(options) + strlen(next_option) + 2;
+			options = realloc(options, options_size);
+			strcat(options, " ");
+			strcat(options, next_option);
+		}
+		free(next_option);
+	}
+	log_debug("config.c: Generated string: %s", options);
+	return options;
+}
+
+bool opt_flag_is_default(const opt_flag_t * flag, int value)
+{
+	const char *def;
+
+	if (flag == NULL || flag->default_value == NULL) {
+		return false;
+	}
+	def = flag->default_value;
+
+	switch (flag->type) {
+	case OPT_RANGE_FLAG:
+		return value == atoi(def);
+	case OPT_LIST_FLAG:
+		return value >= 0 && value < flag->data.list.size
+		    && !strcmp(flag->data.list.values[value], def);
+	case OPT_ONOFF_FLAG:
+		/* The YAML may say it as gcc -Q --help=optimizers would */
+		if (!strcasecmp(def, "on") || !strcasecmp(def, "enabled")
+		    || !strcasecmp(def, "true") || !strcasecmp(def, "yes")) {
+			return value == 1;
+		}
+		if (!strcasecmp(def, "off") || !strcasecmp(def, "disabled")
+		    || !strcasecmp(def, "false") || !strcasecmp(def, "no")) {
+			return value == 0;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+static int opt_compare_options(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+char *opt_flags_to_canonical_string(int num_flags, opt_flag_t ** flags,
+				    const int *values)
+{
+	int i, num_options = 0;
+	char **option = NULL;
+	char *options = NULL;
+	int options_size = 1;
+
+	option = malloc((num_flags + 1) * sizeof(*option));
+	if (option == NULL) {
+		log_fatal("Unable to allocate memory for the compiler options");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (i = 0; i < num_flags; i++) {
+		if (opt_flag_is_default(flags[i], values[i])) {
+			continue;
+		}
+		option[num_options] = opt_flag_to_string(flags[i], values[i]);
+		if (option[num_options] == NULL) {
+			continue;
+		}
+		if (!strcmp(option[num_options], "")) {
+			free(option[num_options]);
+			continue;
+		}
+		options_size += strlen(option[num_options]) + 1;
+		num_options++;
+	}
+	qsort(option, num_options, sizeof(*option), opt_compare_options);
+
+	options = calloc(options_size, sizeof(char));
+	if (options == NULL) {
+		log_fatal("Unable to allocate memory for the compiler options");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (i = 0; i < num_options; i++) {
+		strcat(options, " ");
+		strcat(options, option[i]);
+		free(option[i]);
+	}
+	free(option);
+	log_debug("config.c: Generated canonical string: %s", options);
+	return options;
+}
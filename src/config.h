@@ -31,6 +31,7 @@
 
 #include "common.h"
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <yaml.h>
 
@@ -68,6 +69,8 @@ typedef struct {
 	int num_dependencies;
 	opt_flag_uid *dependencies;	/* array of IDs of other flags that depend on this one being set */
 
+	const char *default_value;	/* What the compiler does without the flag, eg "on", "fast" or "4", or NULL if not known */
+
     /** The flag data
      *
      * Using a union here means that more types can be added later as they are
@@ -106,6 +109,33 @@ typedef struct {
 
 } opt_flag_t;
 
+/** How the task farm chooses the next item from its queue */
+typedef enum opt_scheduler_e {
+	OPT_SCHEDULER_FIFO,	/* In the order they were queued */
+	OPT_SCHEDULER_BEST_FIRST,	/* Best personal best fitness first */
+	OPT_SCHEDULER_COST_AWARE	/* Longest predicted evaluation first */
+} opt_scheduler_t;
+
+/** Which measurement of the benchmark is its fitness (lower is better) */
+typedef enum opt_fitness_metric_e {
+	OPT_METRIC_WALL_TIME,	/* Elapsed time */
+	OPT_METRIC_CPU_TIME,	/* User and system CPU time */
+	OPT_METRIC_USER_TIME,	/* User CPU time only */
+	OPT_METRIC_MAX_RSS,	/* Peak resident set size */
+	OPT_METRIC_CYCLES,	/* CPU cycles in user space */
+	OPT_METRIC_INSTRUCTIONS,	/* Instructions retired in user space */
+	OPT_METRIC_TASK_CLOCK	/* CPU time in user space, counted by perf */
+} opt_fitness_metric_t;
+
+/** How the repeated runs of a benchmark are combined into one fitness */
+typedef enum opt_aggregate_e {
+	OPT_AGGREGATE_MEAN,	/* Mean, rejecting the candidate if too noisy */
+	OPT_AGGREGATE_MEDIAN,	/* Median */
+	OPT_AGGREGATE_MIN,	/* Best run */
+	OPT_AGGREGATE_TRIMMED_MEAN,	/* Mean of the middle 60% of runs */
+	OPT_AGGREGATE_MAD	/* Mean after rejecting outliers by MAD */
+} opt_aggregate_t;
+
 /**
  * The config structure.
  * Contains flag lists as well as other configuration
@@ -113,8 +143,8 @@ typedef struct {
  * well as which compiler we are using.
  */
 typedef struct {
-	/** Details about the compiler itself.  At present, the compiler version
-	 * is not used. */
+	/** Details about the compiler itself.  The name and version are only
+	 * used to tell cached builds apart. */
 	char *compiler;
 	char *compiler_version;
 	int num_flags;
@@ -129,8 +159,78 @@ typedef struct {
 
     int benchmark_timeout; /** A separate timeout for each run of the benchmark */
     int benchmark_repeats; /** Max number of times to repeat benchmark runs */
+    int benchmark_warmup; /** Runs of the benchmark to make and discard first */
+	/** Before benchmarking, wait up to quiet_wait seconds for the node's
+	 * CPUs to be no more than quiet_threshold percent busy.  Zero turns
+	 * the wait off, though the noise is still sampled. */
+	double quiet_threshold;
+	int quiet_wait;
 	double epsilon; /** Experimental error */
+	/** Adaptive timeouts, applied by the master on top of those above.  A
+	 * benchmark run is killed once it takes benchmark_timeout_factor times
+	 * as long as that of the best result so far, and a build once it
+	 * takes longer than the given percentile of earlier successful builds.
+	 * Zero turns either off. */
+	double benchmark_timeout_factor;
+	int build_timeout_percentile;
 	char *perf_test; /** The benchmark itself */
+	opt_fitness_metric_t fitness_metric; /** What of the benchmark to minimise */
+	/** How to combine the repeats.  All but mean keep a noisy candidate,
+	 * rather than scoring it DBL_MAX. */
+	opt_aggregate_t aggregate;
+	/** Read the fitness from what the benchmark prints instead, either the
+	 * first match of fitness_pattern (an extended regex; its first
+	 * subexpression if it has one), or the value of the last line of the
+	 * form fitness_key=value.  Either overrides fitness_metric. */
+	char *fitness_pattern;
+	char *fitness_key;
+	bool maximise; /** Higher is better, eg for GFLOPS */
+	/** Race each candidate against the best result so far, repeating its
+	 * benchmark only until it is worse than that with race_confidence
+	 * (eg 0.95), or until the confidence interval of its mean is within
+	 * epsilon percent of it. */
+	bool racing;
+	double race_confidence;
+	bool exclusive_benchmark; /** Only run one benchmark per node at a time */
+
+	/** If non-zero, this many workers only run benchmarks, using what the
+	 * others have built.  The contents of artifact_dir are passed from
+	 * builder to benchmarker, over MPI or through staging_dir if set. */
+	int benchmark_workers;
+	char *artifact_dir; /** Where the build script leaves what the benchmark needs */
+	char *staging_dir; /** Optional; must be visible to builders and benchmarkers */
+	/** Optional caches of builds, as archives of artifact_dir, keyed by a
+	 * hash of everything under source_dir, the compiler, its version and
+	 * the flags: build_cache on each node, and shared_build_cache on a
+	 * file system every node can see.  A build found in either skips the
+	 * clean and build stages. */
+	char *source_dir;
+	char *build_cache;
+	char *shared_build_cache;
+	/** Optional space-separated glob(3) patterns for the files a build
+	 * produces.  They are hashed after each build, and a build the same
+	 * as one already tested and benchmarked is given the same result
+	 * rather than being tested and benchmarked again. */
+	char *artifact_glob;
+	/** Optional compiler command, with the -O level and anything else the
+	 * build always passes, to ask for the optimisation state each
+	 * candidate's flags come to (with -Q --help=optimizers).  Candidates
+	 * that come to the same state are only evaluated once. */
+	char *effective_flags;
+
+	opt_scheduler_t scheduler; /** Order in which queued work is handed out */
+	bool speculative; /** Give idle workers candidates near the global best */
+	/** Seconds between a busy worker's heartbeats, or 0 for none.  A worker
+	 * not heard from for several of these is given up on. */
+	int heartbeat_interval;
+	/** With a single MPI rank, how many evaluations to run at once, or 0
+	 * for one per online processor */
+	int local_slots;
+	/** How many evaluations each MPI worker runs at once; with more than
+	 * one, there should be one worker per node */
+	int slots_per_worker;
+	bool pin_slots; /** Bind each slot to CPUs of its own */
+	bool slot_numa; /** Keep each slot to one NUMA node, memory and all */
 } opt_config_t;
 
 /**
@@ -167,8 +267,51 @@ void opt_clean_config(opt_config_t * config);
 
 void opt_destroy_config(opt_config_t * config);
 
-int opt_bcast_string(int root, char * string);
+/**
+ * Broadcast a string from root.  Everywhere else, *string must be allocated,
+ * and is reallocated to fit.
+ */
+int opt_bcast_string(int root, char ** string);
 
+/**
+ * Broadcast the config from root to every other rank, including the flag
+ * table, which the workers need to render the positions they are sent.
+ */
 int opt_share_config(int root, opt_config_t * config);
 
+/**
+ * Find the flag with the given uid in the config, or NULL if there is none.
+ */
+opt_flag_t *opt_config_get_flag(opt_config_t * config, opt_flag_uid uid);
+
+/**
+ * Turn a value for the given flag into the string to pass to the compiler,
+ * eg "-funroll-loops" or "--param max-unroll-times=4".  Out of range values
+ * give an empty string.  The caller must free the result.
+ *
+ * Unlike the optimiser's conversions, this may be called on any rank.
+ */
+char *opt_flag_to_string(const opt_flag_t * flag, int value);
+
+/**
+ * Concatenate the strings for each flag with the matching value, separated
+ * by spaces.  The caller must free the result.
+ */
+char *opt_flags_to_string(int num_flags, opt_flag_t ** flags,
+			  const int *values);
+
+/**
+ * Whether the value for the given flag is the same as the flag's default,
+ * so that passing it to the compiler is the same as leaving it out.
+ */
+bool opt_flag_is_default(const opt_flag_t * flag, int value);
+
+/**
+ * As opt_flags_to_string, but leaving out flags at their default and
+ * putting the rest in order, so that values which give the same compiler
+ * options give the same string.  The caller must free the result.
+ */
+char *opt_flags_to_canonical_string(int num_flags, opt_flag_t ** flags,
+				    const int *values);
+
 #endif				/* include guard H_OPTSEARCH_CONFIG_ */
@@ -296,6 +296,87 @@ int opt_db_create_schema(int num_dims, spso_dimension_t ** dims)
 	return rc;
 }
 
+/*
+ * Columns added to the evaluation table since it was first made, with how
+ * to add each to the table of a database made before them.  SQLite can
+ * only add a NOT NULL column if it has a default.
+ */
+static const char *evaluation_columns[][2] = {
+	{"cachedBuild", "INTEGER NOT NULL DEFAULT 0"},
+	{"buildHash", "TEXT"},
+	{"reusedResult", "INTEGER NOT NULL DEFAULT 0"},
+	{"flagsHash", "TEXT"}
+};
+
+static int opt_db_add_evaluation_columns(void)
+{
+	int i, rc, found, retval = 0;
+	int num_columns =
+	    sizeof(evaluation_columns) / sizeof(evaluation_columns[0]);
+	char *errmsg = NULL;
+	char *find_fmt =
+	    "SELECT COUNT(*) FROM pragma_table_info('evaluation') WHERE (name='%s');";
+	char *add_fmt = "ALTER TABLE evaluation ADD COLUMN %s %s;";
+	char *stmt = NULL;
+	size_t size;
+
+	for (i = 0; i < num_columns; i++) {
+		size = strlen(add_fmt) + strlen(find_fmt) +
+		    strlen(evaluation_columns[i][0]) +
+		    strlen(evaluation_columns[i][1]) + 1;
+		stmt = malloc(size);
+		if (stmt == NULL) {
+			log_error("Unable to allocate memory to check the evaluation table");
+			return 1;
+		}
+		found = -1;
+		snprintf(stmt, size, find_fmt, evaluation_columns[i][0]);
+		rc = sqlite3_exec(opt_db, stmt, opt_db_get_int_callback, &found,
+				  &errmsg);
+		if (rc == SQLITE_OK && found == 0) {
+			log_info("data.c: Adding column %s to the evaluation table of an older database.",
+				 evaluation_columns[i][0]);
+			snprintf(stmt, size, add_fmt, evaluation_columns[i][0],
+				 evaluation_columns[i][1]);
+			rc = sqlite3_exec(opt_db, stmt, NULL, NULL, &errmsg);
+		}
+		if (rc != SQLITE_OK) {
+			log_error("SQL error checking column %s of the evaluation table: %s",
+				  evaluation_columns[i][0], errmsg);
+			sqlite3_free(errmsg);
+			errmsg = NULL;
+			retval = 1;
+		}
+		free(stmt);
+	}
+	return retval;
+}
+
+/*
+ * Added after the rest of the schema, so also created when resuming from a
+ * database made before them, and brought up to date if it has an older
+ * evaluation table.
+ */
+static int opt_db_create_evaluation_tables(void)
+{
+	char *tables[] = {
+		"CREATE TABLE IF NOT EXISTS evaluation (id INTEGER NOT NULL UNIQUE, timestamp DATETIME DEFAULT CURRENT_TIMESTAMP NOT NULL, positionID INTEGER, fitness REAL, stage INTEGER NOT NULL, status INTEGER NOT NULL, signal INTEGER NOT NULL, timedOut INTEGER NOT NULL, noisy INTEGER NOT NULL, flagsHash TEXT, cachedBuild INTEGER NOT NULL, buildHash TEXT, reusedResult INTEGER NOT NULL, repeats INTEGER NOT NULL, benchTime REAL, stddev REAL, load REAL, busy REAL, frequency REAL, samples TEXT, PRIMARY KEY (id), FOREIGN KEY (positionID) REFERENCES position(id));",
+		"CREATE TABLE IF NOT EXISTS evaluation_stage (evaluationID INTEGER NOT NULL, stage INTEGER NOT NULL, wallTime REAL NOT NULL, userTime REAL NOT NULL, systemTime REAL NOT NULL, maxRSS INTEGER NOT NULL, FOREIGN KEY (evaluationID) REFERENCES evaluation(id));"
+	};
+	/* After the columns they are on */
+	char *indexes[] = {
+		"CREATE INDEX IF NOT EXISTS 'evaluation_positionID' ON 'evaluation'('positionID');",
+		"CREATE INDEX IF NOT EXISTS 'evaluation_stage_evaluationID' ON 'evaluation_stage'('evaluationID');",
+		"CREATE INDEX IF NOT EXISTS 'evaluation_flagsHash' ON 'evaluation'('flagsHash');"
+	};
+	int rc;
+
+	batch_exec(opt_db, sizeof(tables) / sizeof(tables[0]), tables);
+	rc = opt_db_add_evaluation_columns();
+	batch_exec(opt_db, sizeof(indexes) / sizeof(indexes[0]), indexes);
+	return rc;
+}
+
 int
 opt_db_verify_schema(char *db_name, opt_config_t * config,
 		     int db_search_space_size, spso_dimension_t ** db_search_space)
@@ -351,6 +432,7 @@ opt_db_init(char *db_name, opt_config_t * config, int num_dims,
 			rc = opt_db_verify_schema(db_name, config,
 						  db_search_space_size,
 						  db_search_space);
+			opt_db_create_evaluation_tables();
 			log_debug
 			    ("data.c: Found database with expected file name (%s).  Assuming we are resuming from a previous run.",
 			     db_name);
@@ -380,6 +462,7 @@ opt_db_init(char *db_name, opt_config_t * config, int num_dims,
 			return OPT_DB_ERROR;
 		}
 		rc = opt_db_store_searchspace(db_search_space_size, db_search_space);
+		opt_db_create_evaluation_tables();
 		log_debug("data.c: New database initialised at %s", db_name);
 		ret = OPT_DB_NEW;
 	}
@@ -1761,6 +1844,149 @@ int opt_db_update_particle_history(int particle_id, int new_position_id, int new
 	return rc;
 }
 
+/* A real for SQL, where DBL_MAX (a failure) is kept as NULL */
+static void opt_db_format_real(char *buffer, double value)
+{
+	if (value >= DBL_MAX) {
+		strcpy(buffer, "NULL");
+	} else {
+		sprintf(buffer, "%.17g", value);
+	}
+}
+
+int opt_db_store_evaluation(int pos_id, uint64_t flags_hash,
+			    const opt_task_result_t * result)
+{
+	int rc, i, eval_id;
+	size_t size, length;
+	char *errmsg = NULL;
+	char *stmt_fmt = "INSERT INTO evaluation (positionID, fitness, stage, status, signal, timedOut, noisy, flagsHash, cachedBuild, buildHash, reusedResult, repeats, benchTime, stddev, load, busy, frequency, samples) VALUES(%s, %s, %d, %d, %d, %d, %d, %s, %d, %s, %d, %d, %.17g, %.17g, %.17g, %.17g, %.17g, '";
+	char *stmt_end = "');";
+	char *stage_fmt = "INSERT INTO evaluation_stage (evaluationID, stage, wallTime, userTime, systemTime, maxRSS) VALUES(%d, %d, %.17g, %.17g, %.17g, %.0f);";
+	char *stmt = NULL;
+	char *samples = NULL;
+	char position[CHAR_INT_MAX + 1];
+	char fitness[CHAR_DBL_MAX + 1];
+	char build_hash[2 * sizeof(uint64_t) + 3];
+	char flags[2 * sizeof(uint64_t) + 3];
+
+	/* Each sample as %.17g, and a space */
+	size = result->num_samples * (CHAR_DBL_MAX + 1) + 1;
+	samples = calloc(size, sizeof(char));
+	if (samples == NULL) {
+		log_error("Unable to allocate memory to store an evaluation");
+		return SQLITE_NOMEM;
+	}
+	length = 0;
+	for (i = 0; i < result->num_samples; i++) {
+		length += snprintf(samples + length, size - length,
+				   i > 0 ? " %.17g" : "%.17g",
+				   result->samples[i]);
+	}
+	if (pos_id >= 0) {
+		sprintf(position, "%d", pos_id);
+	} else {
+		strcpy(position, "NULL");
+	}
+	opt_db_format_real(fitness, result->fitness);
+	if (flags_hash != 0) {
+		sprintf(flags, "'%016llx'", (unsigned long long)flags_hash);
+	} else {
+		strcpy(flags, "NULL");
+	}
+	if (result->build_hash != 0) {
+		sprintf(build_hash, "'%016llx'",
+			(unsigned long long)result->build_hash);
+	} else {
+		strcpy(build_hash, "NULL");
+	}
+
+	/* The strings as they are, and the eight integers and five reals */
+	size = strlen(stmt_fmt) + strlen(position) + strlen(fitness) +
+	    strlen(flags) + strlen(build_hash) +
+	    8 * CHAR_INT_MAX + 5 * CHAR_DBL_MAX +
+	    strlen(samples) + strlen(stmt_end) + 1;
+	stmt = calloc(size, sizeof(char));
+	if (stmt == NULL) {
+		log_error("Unable to allocate memory to store an evaluation");
+		free(samples);
+		return SQLITE_NOMEM;
+	}
+	snprintf(stmt, size, stmt_fmt, position, fitness, result->stage,
+		 result->status, result->signal, result->timed_out,
+		 result->noisy, flags, result->cached, build_hash,
+		 result->reused, result->repeats, result->bench_time,
+		 result->stddev, result->load, result->busy, result->freq);
+	strcat(stmt, samples);
+	strcat(stmt, stmt_end);
+	free(samples);
+
+	log_debug("data.c: Executing query: %s", stmt);
+	rc = sqlite3_exec(opt_db, stmt, NULL, NULL, &errmsg);
+	free(stmt);
+	if (rc != SQLITE_OK) {
+		log_error
+		    ("SQL error encountered trying to store an evaluation: %s\n",
+		     errmsg);
+		sqlite3_free(errmsg);
+		return rc;
+	}
+	rc = opt_db_get_last_insert_rowid(&eval_id);
+	if (rc) {
+		return rc;
+	}
+
+	size = strlen(stage_fmt) + 2 * CHAR_INT_MAX + 4 * CHAR_DBL_MAX + 1;
+	stmt = calloc(size, sizeof(char));
+	if (stmt == NULL) {
+		log_error("Unable to allocate memory to store an evaluation");
+		return SQLITE_NOMEM;
+	}
+	for (i = CLEAN_POS; i <= result->stage && i < OPT_TASK_STAGES; i++) {
+		if (result->wall_time[i] <= 0.0) {
+			/* Not run here, eg the build for a benchmarker */
+			continue;
+		}
+		snprintf(stmt, size, stage_fmt, eval_id, i, result->wall_time[i],
+			result->user_time[i], result->system_time[i],
+			result->max_rss[i]);
+		rc = sqlite3_exec(opt_db, stmt, NULL, NULL, &errmsg);
+		if (rc != SQLITE_OK) {
+			log_error
+			    ("SQL error encountered trying to store stage %d of evaluation %d: %s\n",
+			     i, eval_id, errmsg);
+			sqlite3_free(errmsg);
+			break;
+		}
+	}
+	free(stmt);
+	return rc;
+}
+
+int opt_db_find_flags_fitness(uint64_t flags_hash, double *fitness)
+{
+	int rc;
+	char *errmsg = NULL;
+	/* Only a benchmark gives a fitness */
+	char *fmt = "SELECT fitness FROM evaluation WHERE (flagsHash='%016llx') AND (stage=%d) AND (fitness IS NOT NULL) ORDER BY id DESC LIMIT 1;";
+	char *query = malloc(strlen(fmt) + 2 * sizeof(uint64_t) + CHAR_INT_MAX + 1);
+
+	*fitness = DBL_MAX;
+
+	sprintf(query, fmt, (unsigned long long)flags_hash, BENCH_POS);
+	log_debug("data.c: Query statment is: %s", query);
+	rc = sqlite3_exec(opt_db, query, opt_db_get_fitness_callback, fitness,
+			  &errmsg);
+	if (rc != SQLITE_OK) {
+		log_error
+		    ("SQL error encountered trying to get fitness for flags: %s\n",
+		     errmsg);
+		sqlite3_free(errmsg);
+	}
+	free(query);
+	return rc;
+}
+
 int opt_db_update_global_best_history(int new_position_id)
 {
 	int rc;
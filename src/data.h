@@ -24,6 +24,7 @@
 #include "config.h"
 #include "random.h"
 #include "spso.h"
+#include "taskfarm.h"
 
 #include "sqlite3.h"
 
@@ -114,6 +115,22 @@ int opt_db_get_no_move_counter(int *counter);
  */
 int opt_db_store_no_move_counter(int counter);
 
+/**
+ * Record what a worker reported of an evaluation in the evaluation table,
+ * with a row in evaluation_stage for each stage it ran.
+ *
+ * @param pos_id the evaluated position, or -1 if it is not in the database
+ * @param flags_hash the hash of the position's canonical flags, or 0
+ */
+int opt_db_store_evaluation(int pos_id, uint64_t flags_hash,
+			    const opt_task_result_t * result);
+
+/**
+ * Find the latest fitness benchmarked for flags with the given hash (see
+ * opt_flags_to_canonical_string), or DBL_MAX if there is none.
+ */
+int opt_db_find_flags_fitness(uint64_t flags_hash, double *fitness);
+
 int opt_db_store_prev_prev_best(double fitness);
 int opt_db_get_prev_prev_best(double *fitness);
 int opt_db_store_prev_best(double fitness);
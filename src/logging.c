@@ -85,7 +85,7 @@ int log_message(const char *msg)
 							      time(NULL)}
 		 ));
 	fprintf(outstream, "%s (%s:%d) ", timestamp, hostname, rank);
-	fprintf(outstream, msg);
+	fputs(msg, outstream);
 	/* TODO This is unlikely to be a very useful return value */
 	retval = fprintf(outstream, "\n");
 	return retval;
@@ -31,6 +31,61 @@ int search_space_size;
 /* This is a clumsy way to avoid calling opt_stop_search twice */
 bool already_stopped = false;
 
+/*
+ * Speculative candidates are numbered from here, well clear of the particle
+ * UIDs, so that their results can be told apart when they come back.
+ */
+#define OPT_SPECULATIVE_UID_BASE 1000000
+
+typedef struct opt_speculation_s {
+	int uid;
+	spso_position_t *position;
+	struct opt_speculation_s *next;
+} opt_speculation_t;
+
+static opt_speculation_t *speculations = NULL;
+static int num_speculations = 0;
+static int next_speculative_uid = OPT_SPECULATIVE_UID_BASE;
+
+/*
+ * What is asked of the compiler command given as effective-flags.  It
+ * answers in well under a second, so one that takes longer than
+ * OPT_EFFECTIVE_FLAGS_TIMEOUT is not going to, and one that has failed
+ * OPT_EFFECTIVE_FLAGS_MAX_FAILURES times running is not asked again.
+ */
+#define OPT_EFFECTIVE_FLAGS_QUERY " -Q --help=optimizers --help=params"
+#define OPT_EFFECTIVE_FLAGS_TIMEOUT 10
+#define OPT_EFFECTIVE_FLAGS_MAX_FAILURES 3
+
+/*
+ * The optimisation state the compiler said each candidate's flags come to,
+ * by the hash of its canonical flags, so that it is only asked once.
+ * Candidates it could not be asked about are left out, to be asked about
+ * again next time.
+ */
+typedef struct opt_effective_flags_s {
+	uint64_t flags_hash;
+	uint64_t effective_hash;
+	struct opt_effective_flags_s *next;
+} opt_effective_flags_t;
+
+static opt_effective_flags_t *effective_flags = NULL;
+
+/*
+ * Candidates queued for evaluation and not yet reported, by the hash of
+ * their flags.  Particles that land on the same candidate meanwhile wait
+ * for its result rather than have it evaluated again.
+ */
+typedef struct opt_in_flight_s {
+	uint64_t flags_hash;
+	int uid;		/* The particle or speculative candidate queued */
+	int num_waiters;
+	int *waiters;		/* Particle UIDs */
+	struct opt_in_flight_s *next;
+} opt_in_flight_t;
+
+static opt_in_flight_t *in_flight = NULL;
+
 /*
  * TODO
  * - Handle period state recording (similar to checkpointing)
@@ -232,11 +287,279 @@ void opt_stop_search(void)
 	opt_clean_up();
 }
 
+/*
+ * The fitness of a position already evaluated is reported straight back
+ * to SPSO, which moves the particle on and asks for its next position,
+ * which may have been evaluated too.  When the swarm has stagnated, that
+ * can go on for long enough to run out of stack, so rather than recursing,
+ * reports made while one is being handled wait here until it is done.
+ */
+typedef struct opt_known_report_s {
+	int uid;
+	double fitness;
+	int visits;
+	struct opt_known_report_s *next;
+} opt_known_report_t;
+
+static opt_known_report_t *known_reports_front = NULL;
+static opt_known_report_t *known_reports_back = NULL;
+static bool reporting_known = false;
+
+static void opt_report_known_fitness(int uid, double fitness, int visits)
+{
+	opt_known_report_t *report = malloc(sizeof(*report));
+
+	if (report == NULL) {
+		log_fatal("Unable to allocate memory to report a known fitness.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	report->uid = uid;
+	report->fitness = fitness;
+	report->visits = visits;
+	report->next = NULL;
+	if (known_reports_back == NULL) {
+		known_reports_front = report;
+	} else {
+		known_reports_back->next = report;
+	}
+	known_reports_back = report;
+	if (reporting_known) {
+		return;
+	}
+
+	reporting_known = true;
+	while (known_reports_front != NULL) {
+		report = known_reports_front;
+		known_reports_front = report->next;
+		if (known_reports_front == NULL) {
+			known_reports_back = NULL;
+		}
+		opt_report_fitness(report->uid, report->fitness, report->visits);
+		free(report);
+	}
+	reporting_known = false;
+}
+
+/*
+ * Whether the compiler's report mentions the flag with this name, eg as
+ * -funroll-loops, -fstack-reuse=[all|named_vars|none] or
+ * --param=max-unroll-times=.
+ */
+static bool opt_report_mentions(const char *report, const char *name)
+{
+	const char *at;
+	size_t len = strlen(name);
+	char before, after;
+
+	for (at = strstr(report, name); at != NULL; at = strstr(at + 1, name)) {
+		before = at > report ? at[-1] : ' ';
+		if (before == 'f' && at - report >= 2 && at[-2] == '-') {
+			before = '-';
+		}
+		after = at[len];
+		if ((before == '-' || before == '=' || isspace(before))
+		    && (after == '=' || after == '\0' || isspace(after))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Ask the compiler what optimisation state the flags come to, and hash
+ * that.  Flags that make no difference, because they are overridden or
+ * say what the -O level does anyway, then make no difference to the hash.
+ * Any flag the compiler does not report on is hashed as it is.  If the
+ * compiler cannot be asked, the hash of the canonical flags is used.  The
+ * workers' heartbeats are taken while it is asked, as the master is
+ * otherwise held up.
+ */
+static uint64_t opt_effective_flags_hash(uint64_t flags_hash,
+					 opt_flag_t ** flags,
+					 const int *dimension,
+					 const char *options)
+{
+	static int failures = 0;
+	opt_effective_flags_t *known = NULL;
+	char *command = NULL;
+	char *report = NULL;
+	char *option = NULL;
+	char **argv = NULL;
+	uint64_t hash = flags_hash;
+	int i, rc = -1;
+
+	for (known = effective_flags; known != NULL; known = known->next) {
+		if (known->flags_hash == flags_hash) {
+			return known->effective_hash;
+		}
+	}
+	if (failures >= OPT_EFFECTIVE_FLAGS_MAX_FAILURES) {
+		return flags_hash;
+	}
+
+	command = malloc(strlen(opt_config->effective_flags) +
+			 strlen(OPT_EFFECTIVE_FLAGS_QUERY) + strlen(options) + 1);
+	if (command == NULL) {
+		log_fatal("Unable to allocate memory to ask for the effective flags.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	sprintf(command, "%s%s%s", opt_config->effective_flags,
+		OPT_EFFECTIVE_FLAGS_QUERY, options);
+	argv = split_command(command);
+	if (argv != NULL) {
+		set_child_wait_hook(&opt_task_take_heartbeats);
+		rc = run_command_query(argv, &report,
+				       OPT_EFFECTIVE_FLAGS_TIMEOUT);
+		set_child_wait_hook(NULL);
+	}
+	free_command(argv);
+
+	if (rc != 0 || report == NULL) {
+		log_debug("optimiser.c: '%s' returned %d", command, rc);
+		if (++failures == OPT_EFFECTIVE_FLAGS_MAX_FAILURES) {
+			log_warn("Unable to find out the effective flags with '%s', so candidates will be told apart by their flags alone from now on.",
+				 command);
+		}
+		free(report);
+		free(command);
+		return hash;
+	}
+	failures = 0;
+	hash = hash_bytes(OPT_HASH_INIT, report, strlen(report));
+	for (i = 0; i < search_space_size; i++) {
+		if (flags[i] == NULL
+		    || opt_flag_is_default(flags[i], dimension[i])
+		    || opt_report_mentions(report, flags[i]->name)) {
+			continue;
+		}
+		option = opt_flag_to_string(flags[i], dimension[i]);
+		if (option != NULL && strcmp(option, "")) {
+			hash = hash_bytes(hash, option, strlen(option) + 1);
+		}
+		free(option);
+	}
+	free(report);
+	free(command);
+
+	known = malloc(sizeof(*known));
+	if (known == NULL) {
+		log_fatal("Unable to allocate memory to keep the effective flags.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	known->flags_hash = flags_hash;
+	known->effective_hash = hash;
+	known->next = effective_flags;
+	effective_flags = known;
+	return hash;
+}
+
+/*
+ * Positions are the same candidate if they give the same compiler options,
+ * once those left at the compiler's default are dropped and the rest put in
+ * order, or, with effective-flags, if the compiler says they come to the
+ * same thing.  This is the hash of those options, or of what they come to.
+ */
+static uint64_t opt_position_flags_hash(const int *dimension)
+{
+	opt_flag_t **flags = NULL;
+	char *options = NULL;
+	uint64_t hash;
+	int i;
+
+	flags = malloc((search_space_size + 1) * sizeof(*flags));
+	if (flags == NULL) {
+		log_fatal("Unable to allocate memory for the position's flags.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (i = 0; i < search_space_size; i++) {
+		flags[i] = opt_get_flag(search_space[i]->uid);
+	}
+	options = opt_flags_to_canonical_string(search_space_size, flags,
+						dimension);
+	hash = hash_bytes(OPT_HASH_INIT, options, strlen(options));
+	if (opt_config->effective_flags != NULL) {
+		hash = opt_effective_flags_hash(hash, flags, dimension, options);
+	}
+	free(options);
+	free(flags);
+	return hash;
+}
+
+/*
+ * The fitness already measured for a position that is the same candidate
+ * as this one, if there is one worth reusing.
+ */
+static bool opt_find_equivalent_fitness(uint64_t flags_hash, double *fitness)
+{
+	if (opt_db_find_flags_fitness(flags_hash, fitness) != SQLITE_OK) {
+		return false;
+	}
+	return isnormal(*fitness) && *fitness < DBL_MAX;
+}
+
+static opt_in_flight_t *opt_find_in_flight(uint64_t flags_hash)
+{
+	opt_in_flight_t *flight = in_flight;
+
+	while (flight != NULL && flight->flags_hash != flags_hash) {
+		flight = flight->next;
+	}
+	return flight;
+}
+
+static void opt_start_in_flight(uint64_t flags_hash, int uid)
+{
+	opt_in_flight_t *flight = malloc(sizeof(*flight));
+
+	if (flight == NULL) {
+		log_fatal("Unable to allocate memory to track a queued candidate.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	flight->flags_hash = flags_hash;
+	flight->uid = uid;
+	flight->num_waiters = 0;
+	flight->waiters = NULL;
+	flight->next = in_flight;
+	in_flight = flight;
+}
+
+static void opt_wait_in_flight(opt_in_flight_t * flight, int uid)
+{
+	flight->waiters = realloc(flight->waiters, (flight->num_waiters + 1)
+				  * sizeof(*flight->waiters));
+	if (flight->waiters == NULL) {
+		log_fatal("Unable to allocate memory for a waiting particle.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	flight->waiters[flight->num_waiters++] = uid;
+}
+
+/* Stop tracking the candidate queued as uid, returning it if there was one */
+static opt_in_flight_t *opt_land_in_flight(int uid)
+{
+	opt_in_flight_t *flight = in_flight;
+	opt_in_flight_t *prev = NULL;
+
+	while (flight != NULL && flight->uid != uid) {
+		prev = flight;
+		flight = flight->next;
+	}
+	if (flight == NULL) {
+		return NULL;
+	}
+	if (prev == NULL) {
+		in_flight = flight->next;
+	} else {
+		prev->next = flight->next;
+	}
+	return flight;
+}
 
 void opt_add_to_fitness_queue(int particle_uid)
 {
-	char *flag_string = NULL;
 	spso_particle_t *particle = NULL;
+	opt_in_flight_t *flight = NULL;
+	uint64_t flags_hash;
 	int rank, rc;
 	int position_id = -1;
 	int visits = 0;
@@ -288,10 +611,27 @@ void opt_add_to_fitness_queue(int particle_uid)
 		if (visits > 1 && isnormal(fitness) && fitness < DBL_MAX) {
 			/* As a side effect, updating the particle in the DB should increment
 			 * the position counter for us when the fitness is reported back. */
-			opt_report_fitness(particle_uid, fitness, visits);
+			opt_report_known_fitness(particle_uid, fitness, visits);
 			return;
 		}
 	}
+	/* Nor if a different position gives the same flags */
+	flags_hash = opt_position_flags_hash(particle->position.dimension);
+	if (opt_find_equivalent_fitness(flags_hash, &fitness)) {
+		log_debug("optimiser.c: Particle %d has the same flags as a position already measured (%e)",
+			  particle_uid, fitness);
+		opt_report_known_fitness(particle_uid, fitness, visits);
+		return;
+	}
+	/* Nor if it is already queued or being evaluated, in which case the
+	 * result is shared when it comes back */
+	flight = opt_find_in_flight(flags_hash);
+	if (flight != NULL) {
+		log_debug("optimiser.c: Particle %d will wait for the result of %d, which has the same flags",
+			  particle_uid, flight->uid);
+		opt_wait_in_flight(flight, particle_uid);
+		return;
+	}
 	/* 
 	 * Record results in database
 	 *
@@ -302,39 +642,157 @@ void opt_add_to_fitness_queue(int particle_uid)
 	 */
 
 	/*
-	 * Convert position to a command and add it to the task farm queue
+	 * Add the position to the task farm queue.  The workers turn it into
+	 * a command.
 	 */
-	flag_string = build_compiler_options(particle);
-	opt_queue_push(particle_uid, flag_string);
+	opt_start_in_flight(flags_hash, particle_uid);
+	opt_queue_push(particle_uid, particle->position.dimension);
 }
 
-int opt_report_fitness(const int uid, double fitness, int visits)
+/*
+ * Called by the task farm when workers are idle and nothing is queued.  Each
+ * candidate is the global best with one or two dimensions moved to a random
+ * value, so idle workers explore around the incumbent rather than sitting
+ * waiting for the swarm.  Only a handful are allowed out at a time (one per
+ * worker the swarm cannot keep busy, or one if there are none), so that real
+ * work is never held up behind more than a single speculative evaluation.
+ */
+static void opt_speculate(int num_idle)
 {
-	int rank, pos_id, known_positions = 0;
-	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	spso_position_t *best = NULL;
+	spso_fitness_t best_fitness, prev_fitness, prev_prev_fitness;
+	double fitness;
+	spso_swarm_t *swarm = NULL;
+	opt_speculation_t *spec = NULL;
+	uint64_t flags_hash;
+	int limit, changes, dim, pos_id, attempts;
+
+	if (already_stopped || spso_is_stopping()) {
+		return;
+	}
 
-	log_trace("optimiser.c: Optimiser.c: Received fitness %e for particle %d",
-	     fitness, uid);
-	if (MASTER != rank) {
-		log_fatal
-		    ("opt_report_fitness() should only be called by the master rank!");
-		MPI_Abort(MPI_COMM_WORLD, -1);
+	best = spso_get_global_best_history(&best_fitness, &prev_fitness,
+					    &prev_prev_fitness);
+	if (best == NULL || best->dimension == NULL
+	    || best_fitness >= DBL_MAX || search_space_size == 0) {
+		return;
 	}
 
-	if (already_stopped) {
-		log_debug("Ignoring reported fitness as we are stopping.");
+	swarm = spso_get_swarm();
+	limit = opt_task_get_num_workers() - (swarm == NULL ? 0 : swarm->size);
+	if (limit < 1) {
+		limit = 1;
+	}
+
+	/* Give up on positions we have already tried rather than loop forever */
+	attempts = 4 * num_idle;
+	while (num_idle > 0 && num_speculations < limit && attempts-- > 0) {
+		spec = calloc(1, sizeof(*spec));
+		if (spec != NULL) {
+			spec->position = calloc(1, sizeof(*spec->position));
+		}
+		if (spec != NULL && spec->position != NULL) {
+			spec->position->dimension =
+			    malloc(search_space_size *
+				   sizeof(*spec->position->dimension));
+		}
+		if (spec == NULL || spec->position == NULL
+		    || spec->position->dimension == NULL) {
+			/* Only a bonus, so not worth stopping for */
+			log_error("Unable to allocate memory for a speculative candidate.");
+			if (spec != NULL) {
+				free(spec->position);
+			}
+			free(spec);
+			return;
+		}
+		memcpy(spec->position->dimension, best->dimension,
+		       search_space_size * sizeof(*spec->position->dimension));
+
+		changes = opt_rand_int_range(1, 2);
+		while (changes-- > 0) {
+			dim = opt_rand_int_range(0, search_space_size - 1);
+			spec->position->dimension[dim] =
+			    opt_rand_int_range(search_space[dim]->min,
+					       search_space[dim]->max);
+		}
+
+		pos_id = -1;
+		flags_hash = opt_position_flags_hash(spec->position->dimension);
+		if ((!opt_db_find_position(&pos_id, spec->position) && pos_id >= 0)
+		    || opt_find_equivalent_fitness(flags_hash, &fitness)
+		    || opt_find_in_flight(flags_hash) != NULL) {
+			free(spec->position->dimension);
+			free(spec->position);
+			free(spec);
+			continue;
+		}
+
+		spec->uid = next_speculative_uid++;
+		spec->next = speculations;
+		speculations = spec;
+		num_speculations++;
+		num_idle--;
+
+		log_debug("optimiser.c: Queueing speculative candidate %d",
+			  spec->uid);
+		opt_start_in_flight(flags_hash, spec->uid);
+		opt_queue_push_speculative(spec->uid, spec->position->dimension);
+	}
+}
+
+/*
+ * A speculative candidate's result goes into the database like any other,
+ * and is offered to the swarm as a new global best.  No particle moves.
+ */
+static int opt_report_speculative_fitness(const int uid, double fitness)
+{
+	opt_speculation_t *spec = speculations;
+	opt_speculation_t *prev = NULL;
+	int pos_id;
+
+	while (spec != NULL && spec->uid != uid) {
+		prev = spec;
+		spec = spec->next;
+	}
+	if (spec == NULL) {
+		log_error("optimiser.c: Unknown speculative candidate %d", uid);
 		return 0;
 	}
+	if (prev == NULL) {
+		speculations = spec->next;
+	} else {
+		prev->next = spec->next;
+	}
+	num_speculations--;
 
-	opt_db_get_position_count(&known_positions);
+	opt_db_store_position(&pos_id, spec->position);
+	opt_db_update_position_fitness(pos_id, fitness);
 
-	/* 
-	 * Report result back to SPSO for the relevant particle, so it can update
-	 * the velocity, etc.  It should as a side-effect call
-	 * opt_add_to_fitness_queue.
-	 */
-	spso_particle_t *particle = spso_update_particle(uid, fitness, visits, known_positions);
+	if (spso_offer_global_best(fitness, spec->position)) {
+		log_info("Speculative candidate %d improved the global best (%e)",
+			 uid, fitness);
+		opt_checkpoint();
+	}
+
+	free(spec->position->dimension);
+	free(spec->position);
+	free(spec);
+
+	return 1;
+}
+
+/*
+ * The evaluated position is recorded before SPSO moves the particle on, so
+ * that the fitness goes with the position it was measured at.
+ */
+static int opt_report_particle_fitness(const int uid, double fitness,
+				       int visits)
+{
+	spso_particle_t *particle = NULL;
+	int pos_id, known_positions = 0;
 
+	particle = spso_get_particle(uid);
 	if (particle == NULL) {
 		log_error
 		    ("Optimiser.c: Received null particle when attempting to update with fitness information.");
@@ -344,15 +802,109 @@ int opt_report_fitness(const int uid, double fitness, int visits)
 	/* 
 	 * Record results in database
 	 */
-	opt_db_update_particle(particle);
 	opt_db_store_position(&pos_id, &particle->position);
 	opt_db_update_position_fitness(pos_id, fitness);
+
+	opt_db_get_position_count(&known_positions);
+
+	/* 
+	 * Report result back to SPSO for the relevant particle, so it can update
+	 * the velocity, etc.  It should as a side-effect call
+	 * opt_add_to_fitness_queue.
+	 */
+	particle = spso_update_particle(uid, fitness, visits, known_positions);
+
+	opt_db_update_particle(particle);
 	
     opt_checkpoint();
 
 	return 1;
 }
 
+int opt_report_fitness(const int uid, double fitness, int visits)
+{
+	opt_in_flight_t *flight = NULL;
+	int rank, rc, i;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	log_trace("optimiser.c: Optimiser.c: Received fitness %e for particle %d",
+	     fitness, uid);
+	if (MASTER != rank) {
+		log_fatal
+		    ("opt_report_fitness() should only be called by the master rank!");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	if (already_stopped) {
+		log_debug("Ignoring reported fitness as we are stopping.");
+		return 0;
+	}
+
+	flight = opt_land_in_flight(uid);
+
+	if (uid >= OPT_SPECULATIVE_UID_BASE) {
+		rc = opt_report_speculative_fitness(uid, fitness);
+	} else {
+		rc = opt_report_particle_fitness(uid, fitness, visits);
+	}
+
+	/* Particles that landed on the same candidate meanwhile get the same */
+	if (flight != NULL) {
+		for (i = 0; i < flight->num_waiters; i++) {
+			log_debug("optimiser.c: Giving particle %d the fitness measured for %d",
+				  flight->waiters[i], uid);
+			opt_report_known_fitness(flight->waiters[i], fitness, 0);
+		}
+		free(flight->waiters);
+		free(flight);
+	}
+
+	return rc;
+}
+
+/*
+ * Every result the workers send is kept, so that where the time went, and
+ * why candidates failed, can be worked out afterwards.  The fitness has
+ * been reported by now, so the position it was measured at is in the
+ * database, except for a builder's result on a first visit, which comes
+ * before the benchmark, or if we are stopping.  The hash of the flags is
+ * recorded either way, so that equivalent positions can reuse the fitness.
+ */
+static void opt_record_evaluation(const int uid, const int *position,
+				  const opt_task_result_t * result)
+{
+	spso_position_t evaluated;
+	uint64_t flags_hash = 0;
+	int pos_id = -1;
+
+	evaluated.dimension = (int *)position;
+	if (search_space_size == 0
+	    || opt_db_find_position(&pos_id, &evaluated) != SQLITE_OK) {
+		pos_id = -1;
+	}
+	if (search_space_size > 0) {
+		flags_hash = opt_position_flags_hash(position);
+	}
+	if (opt_db_store_evaluation(pos_id, flags_hash, result) != SQLITE_OK) {
+		log_warn("optimiser.c: Unable to record the evaluation for particle %d",
+			 uid);
+	}
+}
+
+/*
+ * For the best-first scheduler: particles with the best personal best go
+ * first.  Those yet to find anything have DBL_MAX, and so go last.
+ */
+static double opt_particle_priority(const int uid)
+{
+	spso_particle_t *particle = spso_get_particle(uid);
+
+	if (particle == NULL) {
+		return DBL_MAX;
+	}
+	return particle->previous_best_fitness;
+}
+
 /* TODO
  * - First pass: Attempt to make search space as small as possible.
  *      - Cut down number of dimensions to search in via hill climbing?
@@ -372,6 +924,7 @@ void opt_init(opt_config_t * conf)
 	spso_position_t *curr_best_position = NULL;
 	spso_fitness_t curr_best_fitness, prev_best_fitness,
 	    prev_prev_best_fitness;
+	int *flag_uids = NULL;
 
 	if (conf == NULL) {
 		log_fatal("Cannot initialise optimiser from a NULL config");
@@ -424,7 +977,26 @@ void opt_init(opt_config_t * conf)
 			  opt_config->num_flags, search_space_size);
 	}
 
-	opt_task_initialise(opt_config, &opt_report_fitness);
+	if (rank == MASTER) {
+		flag_uids = malloc((search_space_size + 1) * sizeof(*flag_uids));
+		if (flag_uids == NULL) {
+			log_fatal("Unable to allocate memory for the dimensions' flag uids.");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		for (i = 0; i < search_space_size; i++) {
+			flag_uids[i] = search_space[i]->uid;
+		}
+	}
+	opt_task_initialise(opt_config, search_space_size, flag_uids,
+			    &opt_report_fitness);
+	free(flag_uids);
+	if (rank == MASTER) {
+		opt_task_set_priority(&opt_particle_priority);
+		opt_task_set_result_listener(&opt_record_evaluation);
+		if (opt_config->speculative) {
+			opt_task_set_idle_listener(&opt_speculate);
+		}
+	}
 
 	log_info("optimiser.c: Got quit signal: '%s'", opt_config->quit_signal);
 
@@ -582,104 +1154,9 @@ opt_flag_t *opt_get_flag(int flag_uid)
 
 char *convert_dimension_to_string(opt_dimension_t * dim, int value)
 {
-	/* this might be gcc specific due to the flag_format */
-	const char *EMPTY = "";
-	char *string = NULL;
-	int flag_size = 0;
-	char *flag_format;
-	int extra_chars;	/* The additional number of chars added by the formatting */
-	opt_flag_t *flag = NULL;
-
 	log_trace("optimiser.c: Converting dimension with UID %d and value %d",
 		  dim->uid, value);
-	flag = opt_get_flag(dim->uid);
-
-	if (flag == NULL) {
-		log_error
-		    ("Unrecognised flag UID, could not convert dimension to corresponding compiler flag.");
-		return NULL;
-	}
-
-	log_debug
-	    ("optimiser.c: flag->uid: %d, flag->name: %s, flag->prefix: %s",
-	     flag->uid, flag->name, flag->prefix);
-
-	switch (flag->type) {
-	case OPT_RANGE_FLAG:
-		if (value > flag->data.range.max
-		    || value < flag->data.range.min) {
-			log_debug
-			    ("optimiser.c: dim value (%d) is out of range",
-			     value);
-			string = strdup(EMPTY);
-			break;
-		}
-		if (flag->data.range.separator == NULL) {
-			log_error
-			    ("Check your YAML.  This flag is invalid (%s) as it has no separator.",
-			     flag->name);
-			string = strdup(EMPTY);
-			break;
-		}
-		flag_format = "%s%s%s%d";
-		extra_chars = strlen(flag_format);
-		flag_size =
-		    strlen(flag->name) + strlen(flag->prefix) +
-		    strlen(flag->data.range.separator) + CHAR_INT_MAX;
-		string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
-		sprintf(string, flag_format, flag->prefix, flag->name,
-			flag->data.range.separator, value);
-		break;
-	case OPT_LIST_FLAG:
-		if (value >= flag->data.list.size || value < 0) {
-			log_debug
-			    ("optimiser.c: dim->value (%d) is out of range",
-			     value);
-			string = strdup(EMPTY);
-			break;
-		}
-		flag_format = "%s%s%s%s";
-		extra_chars = strlen(flag_format);
-		flag_size =
-		    strlen(flag->name) + strlen(flag->prefix) +
-		    strlen(flag->data.list.separator) +
-		    strlen(flag->data.list.values[value]);
-		string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
-		sprintf(string, flag_format, flag->prefix, flag->name,
-			flag->data.list.separator,
-			flag->data.list.values[value]);
-		break;
-	case OPT_ONOFF_FLAG:
-		flag_format = "%s%s";
-		extra_chars = strlen(flag_format);
-		/* TODO Need to check if prefix is bigger than neg_prefix, but
-		 * with GCC it isn't. Also the format might be a bit different */
-		if (value == 1) {
-			flag_size = strlen(flag->name) + strlen(flag->prefix);
-			string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
-			sprintf(string, flag_format, flag->prefix, flag->name);
-		} else if (value == 0) {
-			flag_size =
-			    strlen(flag->name) +
-			    strlen(flag->data.onoff.neg_prefix);
-			string = realloc(string, flag_size + extra_chars + 1);	/* +1 for NULL char */
-			sprintf(string, flag_format,
-				flag->data.onoff.neg_prefix, flag->name);
-		} else {
-			log_debug
-			    ("optimiser.c: dim->value (%d) is out of range",
-			     value);
-			string = strdup(EMPTY);
-		}
-		break;
-	default:
-		log_error
-		    ("Unrecognised flag type, could not convert dimension to compiler flag.");
-		return NULL;
-	}
-	log_debug("optimiser.c: Flag string generated is: \"%s\"", string);
-
-	return string;
+	return opt_flag_to_string(opt_get_flag(dim->uid), value);
 }
 
 char *opt_position_to_string(spso_position_t * position)
@@ -314,9 +314,11 @@ bool spso_should_stop(spso_fitness_t fitness, spso_position_t * position)
 		return spso_stop_flag;
 	}
 
-	if (fitness > spso_global_current_best_fitness) {
+	/* The same fitness again, eg from revisiting the best position or
+	 * from a build identical to it, is no progress either */
+	if (fitness >= spso_global_current_best_fitness) {
 		log_debug
-		    ("Fitness %.6e is greater than global current best of %.6e",
+		    ("Fitness %.6e is no better than global current best of %.6e",
 		     fitness, spso_global_current_best_fitness);
 		if (no_movement_counter >= NO_MOVEMENT_THRESHOLD) {
 			/* We haven't moved for a very long time */
@@ -745,6 +747,18 @@ void spso_update_global_best(spso_fitness_t fitness, spso_position_t * position)
 	}
 }
 
+bool spso_offer_global_best(spso_fitness_t fitness, spso_position_t * position)
+{
+	if (position == NULL || spso_stop_flag
+	    || fitness >= spso_global_current_best_fitness) {
+		return false;
+	}
+	log_debug("Accepting position from outside the swarm as global best");
+	spso_reset_no_movement_counter();
+	spso_update_global_best(fitness, position);
+	return true;
+}
+
 spso_particle_t *spso_update_particle(int particle_id, spso_fitness_t fitness, int visits, int known_positions)
 {
 	int dim;
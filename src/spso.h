@@ -316,6 +316,15 @@ spso_dimension_t *spso_new_dimension(int uid, int min, int max, int value,
 				     const char *name);
 
 
+/**
+ * Offer a position found outside the swarm (eg by evaluating speculative
+ * candidates near the global best) as the new global best.  It is only
+ * taken if it is better than the current best.  No particle is moved.
+ *
+ * @return true if the global best was updated
+ */
+bool spso_offer_global_best(spso_fitness_t fitness, spso_position_t * position);
+
 /**
  * Return the number of iterations with no movement so far.
  */
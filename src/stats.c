@@ -19,6 +19,7 @@
 
 #include "stats.h"
 #include <gsl/gsl_statistics.h>
+#include <gsl/gsl_cdf.h>
 
 /* TODO For now, this will be a wrapper around the GSL functions, but it would
  * be better not to depend on GSL being available (and accurate).
@@ -76,3 +77,125 @@ double percent_of_values(double percent, int num_values, double * values)
 	
 	return (sum / 100.0) * percent;
 }
+
+double t_quantile(double p, double dof)
+{
+	/* Just a wrapper for
+	 * double gsl_cdf_tdist_Pinv (double P, double nu)
+	 */
+	return gsl_cdf_tdist_Pinv(p, dof);
+}
+
+void running_stats_init(opt_running_stats_t * stats)
+{
+	stats->n = 0;
+	stats->mean = 0.0;
+	stats->m2 = 0.0;
+	stats->sum = 0.0;
+	stats->compensation = 0.0;
+	stats->min = DBL_MAX;
+	stats->max = -DBL_MAX;
+}
+
+void running_stats_push(opt_running_stats_t * stats, double value)
+{
+	double delta = value - stats->mean;
+	double y = value - stats->compensation;
+	double t = stats->sum + y;
+
+	stats->n++;
+	stats->mean += delta / stats->n;
+	stats->m2 += delta * (value - stats->mean);
+	stats->compensation = (t - stats->sum) - y;
+	stats->sum = t;
+	stats->min = MIN(stats->min, value);
+	stats->max = MAX(stats->max, value);
+}
+
+double running_stats_stddev(const opt_running_stats_t * stats)
+{
+	if (stats->n < 2) {
+		return 0.0;
+	}
+	return sqrt(stats->m2 / (stats->n - 1));
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+double median(int n, double * values)
+{
+	if (n < 1) {
+		return NAN;
+	}
+	qsort(values, n, sizeof(*values), compare_doubles);
+	if (n % 2) {
+		return values[n / 2];
+	}
+	return (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+double trimmed_mean(int n, double * values, double fraction)
+{
+	int trim = (int)(fraction * n);
+
+	if (n < 1) {
+		return NAN;
+	}
+	qsort(values, n, sizeof(*values), compare_doubles);
+	if (n - 2 * trim < 1) {
+		return median(n, values);
+	}
+	return mean(n - 2 * trim, values + trim);
+}
+
+double scaled_mad(int n, double * values)
+{
+	double centre, mad;
+	double *deviations = NULL;
+	int i;
+
+	if (n < 1) {
+		return NAN;
+	}
+	centre = median(n, values);
+	deviations = malloc(n * sizeof(*deviations));
+	if (deviations == NULL) {
+		return NAN;
+	}
+	for (i = 0; i < n; i++) {
+		deviations[i] = fabs(values[i] - centre);
+	}
+	mad = median(n, deviations);
+	free(deviations);
+	return 1.4826 * mad;
+}
+
+double mad_filtered_mean(int n, double * values, double threshold,
+			 int *kept)
+{
+	opt_running_stats_t stats;
+	double centre, spread;
+	int i;
+
+	running_stats_init(&stats);
+	if (n > 0) {
+		spread = scaled_mad(n, values);
+		centre = median(n, values);
+		for (i = 0; i < n; i++) {
+			/* With no spread at all, only the outliers differ */
+			if (fabs(values[i] - centre) <= threshold * spread) {
+				running_stats_push(&stats, values[i]);
+			}
+		}
+	}
+	if (kept != NULL) {
+		*kept = stats.n;
+	}
+	return stats.n > 0 ? stats.mean : NAN;
+}
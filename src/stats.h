@@ -43,4 +43,60 @@ double standard_deviation_with_mean(int n, double * values, double mean);
  */
 double percent_of_values(double percent, int num_values, double * values);
 
+/**
+ * The value that a Student's t distributed variable with dof degrees of
+ * freedom falls below with probability p, eg for confidence intervals.
+ */
+double t_quantile(double p, double dof);
+
+/**
+ * Running statistics of a stream of values, updated one value at a time:
+ * the mean and variance by Welford's method, and the sum with Kahan
+ * summation, so that neither loses precision however many values there are.
+ */
+typedef struct {
+	int n;
+	double mean;
+	double m2; /** Sum of squared differences from the mean */
+	double sum;
+	double compensation; /** Low-order bits lost from sum */
+	double min;
+	double max;
+} opt_running_stats_t;
+
+void running_stats_init(opt_running_stats_t * stats);
+
+void running_stats_push(opt_running_stats_t * stats, double value);
+
+/** The sample standard deviation, or 0 for fewer than two values */
+double running_stats_stddev(const opt_running_stats_t * stats);
+
+/**
+ * The median of the values, which are left in ascending order.
+ */
+double median(int n, double * values);
+
+/**
+ * The mean of the values once the lowest and highest fraction (eg 0.2) of
+ * them have been discarded.  The values are left in ascending order.
+ */
+double trimmed_mean(int n, double * values, double fraction);
+
+/**
+ * The median absolute deviation from the median, scaled by 1.4826 so that
+ * it estimates the standard deviation of normally distributed values.  The
+ * values are left in ascending order.
+ */
+double scaled_mad(int n, double * values);
+
+/**
+ * The mean of the values after rejecting as outliers any more than
+ * threshold times scaled_mad from the median.  The values are left in
+ * ascending order.
+ *
+ * @param kept if not NULL, where to store how many values were used
+ */
+double mad_filtered_mean(int n, double * values, double threshold,
+			 int *kept);
+
 #endif				/* include guard H_OPTSEARCH_STATS_ */
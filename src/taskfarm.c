@@ -24,23 +24,140 @@
 typedef enum {
 	OPT_TASK_STOPPED,
 	OPT_TASK_BUSY,
-	OPT_TASK_WAITING
+	OPT_TASK_WAITING,
+	OPT_TASK_LOST,		/* Given up on; see opt_task_lose_worker */
+	OPT_TASK_STOPPING	/* Lost, and since told to stop; see opt_task_stop_lost */
 } opt_task_state_e;
 
+/*
+ * With config->benchmark_workers set, the workers are split into two pools:
+ * builders run the clean, build and accuracy test, and archive the contents
+ * of config->artifact_dir; benchmarkers unpack that and only run the
+ * benchmark.  Otherwise every worker does everything.
+ */
 typedef enum {
-	QUIT_POS = 0,
-	CLEAN_POS = 1,
-	BUILD_POS = 2,
-	TEST_POS = 3,
-	BENCH_POS = 4
-} opt_task_position_e;
+	OPT_TASK_BUILD_AND_BENCH,
+	OPT_TASK_BUILDER,
+	OPT_TASK_BENCHMARKER
+} opt_task_role_e;
+
+/*
+ * The commands for each stage, indexed by opt_task_position_e, split into
+ * arguments once by opt_task_prepare_commands rather than being pasted
+ * into a shell command line for every evaluation.  An argument may contain
+ * {flags} or {slot}, which opt_task_prepare_evaluation replaces in args
+ * with the flags being tried and OPTSEARCH_SLOT.  The flags are always in
+ * the environment as FLAGS too, in eval_env.
+ */
+typedef struct {
+	char **argv;
+	char **args;
+	bool templated;
+} opt_task_command_t;
+
+static opt_task_command_t stage_command[BENCH_POS + 1];
+static char **eval_env = NULL;
+static char *eval_flags_env = NULL;
+
+/*
+ * The build cache (see config->build_cache): whether it is in use, the hash
+ * of the source, taken once by the master, and the key of the build of the
+ * flags being evaluated and their canonical form, which the key is taken
+ * from, both set by opt_task_prepare_evaluation.
+ */
+static bool use_build_cache = false;
+static uint64_t source_hash = OPT_HASH_INIT;
+static char cache_key[2 * sizeof(uint64_t) + 1];
+static char *cache_flags = NULL;
+
+/* config->fitness_pattern, compiled once by opt_task_prepare_commands */
+static regex_t fitness_regex;
+static bool have_fitness_regex = false;
 
 /* A simple mapping of worker rank to pointer of what they are working on.
  * NULL means nothing (waiting or stopped).  The worker_state array will
- * confirm it.
+ * confirm it.  As workers are sent their next item before they finish the
+ * current one, each entry is the head of a list (linked through next) of
+ * the items in the order they were sent, and in_flight holds its length.
  */
 opt_work_item_t **working_on_item = NULL;
 opt_task_state_e *worker_state = NULL;
+int *in_flight = NULL;
+
+/* Receives for worker results are posted as soon as a worker is given work,
+ * so that the master can wait on all of them at once rather than probing.
+ * Both arrays are indexed by worker rank; the MASTER slot is never used and
+ * its request stays as MPI_REQUEST_NULL.
+ */
+MPI_Request *result_request = NULL;
+opt_task_result_t *result_buffer = NULL;
+
+/* What results are sent as, committed once by opt_task_initialise */
+static MPI_Datatype result_type = MPI_DATATYPE_NULL;
+
+/*
+ * With config->exclusive_benchmark, workers ask the master before starting
+ * a benchmark, and at most one worker per node is allowed to be running
+ * one.  Builds and tests are unaffected.  The receives for these requests
+ * follow those for results in the same array (bench_request is
+ * result_request + size), so that both can be waited on together.
+ *
+ * Nodes are identified by the lowest world rank on them, so node_of_rank
+ * and node_benchmarking are both indexed by rank.  A node with no benchmark
+ * running has -1 in node_benchmarking.
+ */
+MPI_Request *bench_request = NULL;
+int *bench_buffer = NULL;
+bool *wants_benchmark = NULL;
+double *bench_requested = NULL;
+int *node_of_rank = NULL;
+int *node_benchmarking = NULL;
+
+/*
+ * Liveness.  Busy workers send a heartbeat every config->heartbeat_interval
+ * seconds, which the master receives in the third part of result_request
+ * (heartbeat_request is result_request + 2 * size).  A worker with work
+ * outstanding is given up on once it has not been heard from for
+ * OPT_TASK_MISSED_HEARTBEATS intervals, or once the item it is working on
+ * is past its deadline.  Its work goes back on the queue for someone else.
+ */
+#define OPT_TASK_MISSED_HEARTBEATS 4
+#define OPT_TASK_DEADLINE_GRACE 60.0
+MPI_Request *heartbeat_request = NULL;
+int *heartbeat_buffer = NULL;
+double *last_heard = NULL;
+
+/*
+ * Builds already tested and benchmarked (see config->artifact_glob), by
+ * the hash of their files, with their results.  The master keeps them all,
+ * and answers workers' queries from them; the queries are received in the
+ * fourth part of result_request (build_request is result_request + 3 *
+ * size).  Slots cannot ask the master, so a worker with several keeps the
+ * results of its own, and each slot, like the master's local slots, looks
+ * in the list as it was when the slot started.
+ */
+typedef struct opt_task_known_build_s {
+	opt_task_result_t result;
+	struct opt_task_known_build_s *next;
+} opt_task_known_build_t;
+
+static opt_task_known_build_t *known_builds = NULL;
+MPI_Request *build_request = NULL;
+uint64_t *build_buffer = NULL;
+static bool in_slot = false;
+
+/* Worker side: when we last sent a heartbeat, and the send itself */
+static double last_heartbeat = 0.0;
+static MPI_Request heartbeat_send = MPI_REQUEST_NULL;
+
+/*
+ * Bounds, in microseconds, on how long the master sleeps between checks of
+ * the posted receives.  The delay starts small and doubles while nothing is
+ * happening, so a result arriving shortly after the last one is seen almost
+ * immediately, while a long wait costs next to no CPU time.
+ */
+#define OPT_TASK_MIN_WAIT_US 10
+#define OPT_TASK_MAX_WAIT_US 1000
 
 /* TODO
  *
@@ -49,6 +166,8 @@ opt_task_state_e *worker_state = NULL;
  * The Master will need to:
  * - Poll all workers and find out who is on which nodes; Construct a set of
  *   active workers, who do not share nodes with anyone else in the set.
+ *   (Done via opt_task_discover_nodes; rather than idling workers, only the
+ *   benchmarks are serialised per node, when exclusive-benchmark is set.)
  * - Receive new tasks into the work queue.
  * - Listen for responses from workers; report these back to the calling
  *   process, which should record all results into SQLite and populate our
@@ -106,7 +225,9 @@ opt_task_state_e *worker_state = NULL;
  * The actual item we need is the FLAGS, which might be FFLAGS or CFLAGS or
  * similar.  This means it is really only ONE string, that is prepended to
  * the strings already derived from the opt_config_t* before each command is
- * run.
+ * run.  Rather than building that string on the master, we send the workers
+ * the position itself, and they build the string from the flags they were
+ * given by opt_share_config.
  *
  * They must always be run in this order; each one must end cleanly without
  * errors for the next one to run, or we will notify the listener that the
@@ -130,545 +251,3609 @@ int queue_size;
 opt_work_item_t *queue_front;
 opt_work_item_t *queue_back;
 
+/* Used by the best-first scheduler; see opt_task_set_priority */
+static double (*item_priority) (const int) = NULL;
+
+/* Called when workers are idle; see opt_task_set_idle_listener */
+static void (*idle_listener) (int) = NULL;
+
+/* Given every result; see opt_task_set_result_listener */
+static void (*result_listener) (const int, const int *,
+				const opt_task_result_t *) = NULL;
+
+/*
+ * What each evaluation (by uid) took last time, for the cost-aware
+ * scheduler.  Times are smoothed, since the same uid (particle) moves
+ * around the search space and the flags change each time.  A uid with no
+ * history is predicted to take the mean of everything so far.
+ */
+#define OPT_TASK_COST_SMOOTHING 0.5
+static double *uid_cost = NULL;
+static int uid_cost_size = 0;
+static double total_cost = 0.0;
+static int num_costs = 0;
+
+/*
+ * For the adaptive timeouts (see opt_task_bench_timeout and
+ * opt_task_build_timeout): how long each benchmark run took for the best
+ * result so far, and the most recent successful build times, kept in a
+ * ring.  Build timeouts only adapt once there are enough of these to say
+ * what a slow build looks like.
+ */
+#define OPT_TASK_BUILD_HISTORY 256
+#define OPT_TASK_MIN_BUILD_HISTORY 20
+static double best_fitness = DBL_MAX;
+static double best_bench_time = DBL_MAX;
+/* The rest of the best result's statistics, for racing against it */
+static double best_mean = DBL_MAX;
+static double best_stddev = 0.0;
+static double best_repeats = 0.0;
+static double build_times[OPT_TASK_BUILD_HISTORY];
+static int num_build_times = 0;
+
+/* Items that have been built and are waiting for a benchmarker */
+static int bench_queue_size = 0;
+static opt_work_item_t *bench_queue_front = NULL;
+static opt_work_item_t *bench_queue_back = NULL;
+
 bool stop_work = false;
 
+/* Set whenever the queue gains work (or we are told to stop), so that a
+ * waiting master wakes up and dispatches straight away. */
+static volatile sig_atomic_t wake_master = 0;
+
 static int msg_sequence;
 
+/* The flag corresponding to each dimension of the positions we are sent */
+static int num_dims = 0;
+static opt_flag_t **dim_flags = NULL;
+
+/*
+ * With a single MPI rank there are no workers, and each evaluation is run
+ * in a forked process of its own instead, in one of num_slots slots.  The
+ * result comes back on a pipe.  A slot with no pid is free.  Exclusive
+ * benchmarks are serialised with flock(2) on local_lock_path.  Each slot
+ * keeps the process group of the command it is running in slot_pgid, which
+ * is shared with the parent, so that the command can be killed along with
+ * the slot.
+ */
+typedef struct {
+	pid_t pid;
+	int fd;
+	opt_work_item_t *item;
+} opt_task_slot_t;
+
+static opt_task_slot_t *slots = NULL;
+static volatile pid_t *slot_pgid = NULL;
+static int num_slots = 0;
+static char *local_lock_path = NULL;
+static struct pollfd *slot_fds = NULL;
+static int *slot_of_fd = NULL;
+
+/*
+ * Workers may have several slots too (config->slots_per_worker).  Their
+ * OPTSEARCH_SLOT values start from slot_env_base, so that they are unique
+ * across workers.  With config->pin_slots, each slot is bound to the CPUs
+ * in slot_cpus, and with config->slot_numa, its memory to slot_node.
+ */
+#define OPT_TASK_SLOT_POLL_MS 50
+#define OPT_TASK_MPOL_BIND 2	/* From numaif.h, which we do without */
+static int slot_env_base = 0;
+static cpu_set_t *slot_cpus = NULL;
+static int *slot_node = NULL;
+
 int opt_get_msg_seq(void)
 {
 	return ++msg_sequence;
 }
 
-int opt_task_initialise(opt_config_t * conf,
-			int (*report_fitness) (const int, double, int))
+/* The benchmarkers are the highest ranks, so that with the usual mapping of
+ * ranks to nodes, they get nodes to themselves. */
+static opt_task_role_e opt_task_get_role(int rank)
 {
-	int i, my_rank, size;
-
-	log_trace("taskfarm.c: Entered opt_task_initialise in taskfarm.c");
+	int size;
 
-	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	if (config->benchmark_workers <= 0) {
+		return OPT_TASK_BUILD_AND_BENCH;
+	}
 	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	if (rank >= size - config->benchmark_workers) {
+		return OPT_TASK_BENCHMARKER;
+	}
+	return OPT_TASK_BUILDER;
+}
 
-	msg_sequence = 0;
-	config = conf;
-
+/*
+ * Work out which ranks share a node, and gather the answer on the master.
+ * This is collective over MPI_COMM_WORLD.
+ */
+static void opt_task_discover_nodes(int my_rank, int size)
+{
+	int node_id, node_rank, i, num_nodes = 0;
+	MPI_Comm node_comm;
+
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+			    MPI_INFO_NULL, &node_comm);
+	MPI_Comm_rank(node_comm, &node_rank);
+	/* Name each node after its lowest world rank (node_rank 0, as we kept
+	 * the world ordering with a key of 0) */
+	node_id = my_rank;
+	MPI_Bcast(&node_id, 1, MPI_INT, 0, node_comm);
+	MPI_Comm_free(&node_comm);
+
+	MPI_Gather(&node_id, 1, MPI_INT, node_of_rank, 1, MPI_INT, MASTER,
+		   MPI_COMM_WORLD);
 	if (MASTER == my_rank) {
-		queue_size = 0;
-		queue_front = NULL;
-		queue_back = NULL;
-		log_trace("taskfarm.c: size is %d", size);
-		working_on_item = malloc(size * sizeof(*working_on_item));
-		worker_state = malloc(size * sizeof(*worker_state));
 		for (i = 0; i < size; i++) {
-			working_on_item[i] = NULL;
-			worker_state[i] = OPT_TASK_WAITING;
+			if (node_of_rank[i] == i) {
+				num_nodes++;
+			}
 		}
-		update_fitness = report_fitness;
-	} else {
-		/* I'm doing this on purpose so that we have an error if a worker
-		 * calls it by mistake, which should never happen */
-		update_fitness = NULL;
+		log_info("taskfarm.c: %d ranks are spread over %d nodes", size,
+			 num_nodes);
 	}
-
-	return 0;
 }
 
-opt_work_item_t *opt_queue_pop(void)
+static void opt_task_alloc_slots(int count)
 {
-	log_trace("taskfarm.c: Entered opt_queue_pop in taskfarm.c");
-	opt_work_item_t *item = queue_front;
-	if (item != NULL) {
-		queue_front = item->next;
-		item->next = NULL;
-		queue_size--;
+	int slot;
+
+	num_slots = MAX(count, 1);
+	slots = malloc(num_slots * sizeof(*slots));
+	slot_fds = malloc(num_slots * sizeof(*slot_fds));
+	slot_of_fd = malloc(num_slots * sizeof(*slot_of_fd));
+	if (slots == NULL || slot_fds == NULL || slot_of_fd == NULL) {
+		log_fatal("Unable to allocate memory to keep track of slots.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	slot_pgid = mmap(NULL, num_slots * sizeof(*slot_pgid),
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			 -1, 0);
+	if (slot_pgid == MAP_FAILED) {
+		log_fatal("Unable to map memory to share with slots: %s",
+			  strerror(errno));
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (slot = 0; slot < num_slots; slot++) {
+		slots[slot].pid = 0;
+		slots[slot].fd = -1;
+		slots[slot].item = NULL;
+		slot_pgid[slot] = 0;
 	}
-	return item;
 }
 
-int opt_queue_push(const int work_item_uid, const char *work_item)
+static void opt_task_prepare_command(opt_task_position_e pos,
+				     const char *command)
 {
-	int my_rank;
-	opt_work_item_t *work = NULL;
-	log_trace("taskfarm.c: Entered opt_queue_push in taskfarm.c");
-
-	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	opt_task_command_t *stage = &stage_command[pos];
+	int i, argc = 0;
 
-	/* We should only get called if we are rank 0, so the check should be
-	 * unnecessary */
-	if (MASTER == my_rank) {
-		/* TODO We should be checking that malloc and realloc are successful */
-		errno = 0;
-		work = malloc(sizeof(*work));
-		if (work == NULL) {
-			if (errno == ENOMEM) {
-				log_error("Out of memory.");
-			}
-			log_fatal
-			    ("Unable to allocate memory for addition of work item to queue.");
-			MPI_Abort(MPI_COMM_WORLD, -1);
+	for (i = 0; stage->args != NULL && stage->argv[i] != NULL; i++) {
+		if (stage->args[i] != stage->argv[i]) {
+			free(stage->args[i]);
 		}
-		work->command = strdup(work_item);	/* This also needs a check that malloc was successful */
-		work->uid = work_item_uid;
-		work->next = NULL;
+	}
+	free_command(stage->argv);
+	free(stage->args);
+	stage->argv = NULL;
+	stage->args = NULL;
+	stage->templated = false;
+	if (command == NULL) {
+		return;
+	}
 
-		if (queue_front == NULL) {
-			queue_front = work;
-		}
-		if (queue_back != NULL) {
-			queue_back->next = work;
+	stage->argv = split_command(command);
+	if (stage->argv == NULL) {
+		log_fatal("Unable to allocate memory for command %s", command);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	while (stage->argv[argc] != NULL) {
+		if (strstr(stage->argv[argc], "{flags}") != NULL
+		    || strstr(stage->argv[argc], "{slot}") != NULL) {
+			stage->templated = true;
 		}
-		queue_back = work;
-		queue_size++;
-
-		return queue_size;
+		argc++;
 	}
-	return 0;
-}
-
-int opt_task_stop(void)
-{
-	/* Signal that the task farm should stop work */
-	stop_work = true;
-	return 0;
+	stage->args = calloc(argc + 1, sizeof(*stage->args));
+	if (stage->args == NULL) {
+		log_fatal("Unable to allocate memory for command %s", command);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (i = 0; i < argc; i++) {
+		stage->args[i] = stage->argv[i];
+	}
+	log_debug("taskfarm.c: Command %s has %d arguments%s.", command, argc,
+		  stage->templated ? ", some templated" : "");
 }
 
-int opt_task_clean_up(void)
+/* Split up the scripts from the config, ready to run */
+static void opt_task_prepare_commands(void)
 {
-	int my_rank, size, i;
-	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
-	log_trace("taskfarm.c: Entered opt_task_clean_up in taskfarm.c");
-	opt_work_item_t *item = NULL;
+	char error[256];
+	int rc;
 
-	/*
-	 * TODO notify workers if we hadn't been intending to stop before.
-	 */
+	opt_task_prepare_command(CLEAN_POS, config->clean_script);
+	opt_task_prepare_command(BUILD_POS, config->build_script);
+	opt_task_prepare_command(TEST_POS, config->accuracy_test);
+	opt_task_prepare_command(BENCH_POS, config->perf_test);
 
-	if (!stop_work) {
-		log_warn
-		    ("Have not been told to stop, but the clean_up function has been called");
-		opt_task_stop();
+	if (have_fitness_regex) {
+		regfree(&fitness_regex);
+		have_fitness_regex = false;
+	}
+	if (config->fitness_pattern != NULL && config->fitness_key == NULL) {
+		rc = regcomp(&fitness_regex, config->fitness_pattern,
+			     REG_EXTENDED | REG_NEWLINE);
+		if (rc != 0) {
+			regerror(rc, &fitness_regex, error, sizeof(error));
+			log_fatal("Invalid fitness-pattern '%s': %s",
+				  config->fitness_pattern, error);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		have_fitness_regex = true;
 	}
-
-	/*
-	 * FIXME Calling free seems to cause a double free later, as
-	 * MPI_Finalize() appears to struggle to work out what needs to be free'd
-	 * and frees things incorrectly.  It doesn't affect all our allocated
-	 * memory, but does affect a lot of it.  What is and is not affected is
-	 * unpredictable, and seems to change with the version of OpenMPI we are
-	 * using, so I am just commenting out this entire section.  It causes too
-	 * many problems otherwise.
-	 */
-	/*
-	   if (MASTER == my_rank) {
-		   item = queue_front;
-		   while (item != NULL) {
-		   if (item->command != NULL)
-			   free(item->command);
-			   item->command = NULL;
-			   free(item);
-			   item = NULL;
-			   item = opt_queue_pop();
-		   }
-		   queue_front = NULL;
-		   MPI_Comm_size(MPI_COMM_WORLD, &size);
-		   for (i = 1; i < size; i++) {
-			   working_on_item[i] = NULL;
-		   }
-		   //free(working_on_item);
-		   working_on_item = NULL;
-		   free(worker_state);
-	   }
-	 */
-
-	return 0;		/* TODO Return something more useful */
 }
 
-opt_task_msg_t opt_task_receive_work(opt_work_item_t * item)
+/*
+ * Find the fitness in what the benchmark printed, as config->fitness_key or
+ * config->fitness_pattern says.  Returns 0 and sets value if it was there.
+ */
+static int opt_task_read_fitness(const char *output, double *value)
 {
-	int rc = 0;
-	int header[4] = { 0 };
-	MPI_Status status;
-
-	rc = MPI_Recv(header, 4, MPI_INT, MASTER, OPT_TASK_HEADER_TAG,
-		      MPI_COMM_WORLD, &status);
-	if (rc != MPI_SUCCESS) {
-		log_fatal
-		    ("Receiving header from master was unsuccessful.  Received code: %d from MPI_Recv",
-		     rc);
-		MPI_Abort(MPI_COMM_WORLD, rc);
+	regmatch_t match[2];
+	const char *line = NULL;
+	const char *start = NULL;
+	char *end = NULL;
+	size_t key_len;
+	int found = 1;
+
+	if (output == NULL) {
+		return 1;
 	}
-	log_trace("taskfarm.c: Received header (seq #%d) from master",
-		  header[OPT_HEADER_SEQ]);
-	if (header[OPT_HEADER_TYPE] == OPT_TASK_STOP_MSG) {
-		log_debug("taskfarm.c: Told to stop work by master (msg #%d)",
-			  header[OPT_HEADER_SEQ]);
-		stop_work = true;
-	} else {
-		log_debug
-		    ("taskfarm.c: Receiving message of size %d (seq #%d) from master",
-		     header[OPT_HEADER_SIZE], header[OPT_HEADER_SEQ]);
-		item->uid = header[OPT_HEADER_UID];
-		item->command = realloc(item->command, header[OPT_HEADER_SIZE]);
-		/* Receive actual message */
-		rc = MPI_Recv(item->command, header[OPT_HEADER_SIZE], MPI_CHAR,
-			      MASTER, OPT_TASK_MSG_TAG, MPI_COMM_WORLD,
-			      &status);
-		if (rc != MPI_SUCCESS) {
-			log_fatal
-			    ("Receiving message #%d from master was unsuccessful.  Received code: %d from MPI_Recv",
-			     header[OPT_HEADER_SEQ], rc);
-			MPI_Abort(MPI_COMM_WORLD, rc);
+	if (config->fitness_key != NULL) {
+		/* The last key=value line wins, so progress can be printed too */
+		key_len = strlen(config->fitness_key);
+		for (line = output; line != NULL && *line != '\0';
+		     line = strchr(line, '\n') != NULL ?
+		     strchr(line, '\n') + 1 : NULL) {
+			start = line + strspn(line, " \t");
+			if (strncmp(start, config->fitness_key, key_len) != 0) {
+				continue;
+			}
+			start += key_len;
+			start += strspn(start, " \t");
+			if (*start != '=') {
+				continue;
+			}
+			start++;
+			*value = strtod(start, &end);
+			if (end != start) {
+				found = 0;
+			}
+		}
+	} else if (have_fitness_regex
+		   && regexec(&fitness_regex, output, 2, match, 0) == 0) {
+		if (match[1].rm_so < 0) {
+			match[1] = match[0];
+		}
+		start = output + match[1].rm_so;
+		*value = strtod(start, &end);
+		if (end != start && end <= output + match[1].rm_eo) {
+			found = 0;
 		}
-		/*log_trace
-		    ("taskfarm.c: Received message (seq #%d): '%s' from master",
-		     header[OPT_HEADER_SEQ], item->command);*/
 	}
-	return header[OPT_HEADER_TYPE];
+	if (found) {
+		log_error("Unable to find the fitness in the benchmark output");
+	}
+	return found;
 }
 
-int opt_task_send_to_worker(int worker, opt_task_msg_t type,
-			    opt_work_item_t * item)
+/* Returns a copy of arg with every {name} in it replaced by value */
+static char *opt_task_fill_template(const char *arg, const char *name,
+				    const char *value)
 {
-	int rc = 0;
-	int seq;
-	int header[4] = { 0 };
-	char *buffer = NULL;
-
-	if (item == NULL && type != OPT_TASK_STOP_MSG) {
-		log_error("Cannot send NULL work item to workers");
-		return 1;
+	const char *from = NULL;
+	const char *at = NULL;
+	char *filled = NULL;
+	char *to = NULL;
+	size_t name_len = strlen(name);
+	int count = 0;
+
+	for (at = strstr(arg, name); at != NULL; at = strstr(at + name_len, name)) {
+		count++;
 	}
-
-	if (working_on_item[worker] != NULL) {
-		log_debug
-		    ("taskfarm.c: Worker %d was already working on something, which is about to be lost (particle uid was %d)",
-		     worker, working_on_item[worker]->uid);
+	filled = malloc(strlen(arg) + count * strlen(value) + 1);
+	if (filled == NULL) {
+		log_fatal("Unable to allocate memory for command arguments");
+		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
-
-	header[OPT_HEADER_TYPE] = type;
-	seq = opt_get_msg_seq();
-	header[OPT_HEADER_SEQ] = seq;
-
-	if (type == OPT_TASK_WORK_MSG) {
-		header[OPT_HEADER_UID] = item->uid;
-		header[OPT_HEADER_SIZE] = strlen(item->command) + 1;	/* +1 for '\0' */
-		buffer = item->command;
-	} else {
-		header[OPT_HEADER_SIZE] = 1;
+	to = filled;
+	from = arg;
+	for (at = strstr(from, name); at != NULL; at = strstr(from, name)) {
+		memcpy(to, from, at - from);
+		to += at - from;
+		strcpy(to, value);
+		to += strlen(value);
+		from = at + name_len;
 	}
+	strcpy(to, from);
+	return filled;
+}
 
-	log_trace
-	    ("taskfarm.c: Sending header (%d) for message of type %d to worker rank %d",
-	     seq, type, worker);
-	/* Send the header for the message */
-	rc = MPI_Send(header, 4, MPI_INT, worker, OPT_TASK_HEADER_TAG,
-		      MPI_COMM_WORLD);
-	if (rc != MPI_SUCCESS) {
-		log_fatal
-		    ("Sending header (%d) to worker %d was unsuccessful.  Received code: %d from MPI_Send",
-		     seq, worker, rc);
-		MPI_Abort(MPI_COMM_WORLD, rc);
+static uint64_t opt_task_hash_string(uint64_t hash, const char *string)
+{
+	if (string == NULL) {
+		string = "";
 	}
+	/* With the terminator, so that "ab", "c" differs from "a", "bc" */
+	return hash_bytes(hash, string, strlen(string) + 1);
+}
 
-	if (type != OPT_TASK_STOP_MSG) {
-		log_trace
-		    ("taskfarm.c: Sending message (%d) of size %d and type %d to worker rank %d",
-		     seq, header[OPT_HEADER_SIZE], type, worker);
-		rc = MPI_Send(buffer, header[OPT_HEADER_SIZE], MPI_CHAR, worker,
-			      OPT_TASK_MSG_TAG, MPI_COMM_WORLD);
-		/* Probably ought to treat this the same way as the header, and abort if
-		 * it fails. */
-		/* Keep track of which particle this worker is working on */
-		working_on_item[worker] = item;
-		worker_state[worker] = OPT_TASK_BUSY;
-	} else {
-		working_on_item[worker] = NULL;
-		worker_state[worker] = OPT_TASK_STOPPED;
-	}
+/*
+ * A build is known by the source it was built from, the compiler and how
+ * it was built, and the flags.  Flags that differ only in order, or in
+ * saying what the compiler would do anyway, give the same build.
+ */
+static void opt_task_set_cache_key(const int *position)
+{
+	uint64_t hash = OPT_HASH_INIT;
 
-	return rc;
+	if (cache_flags != NULL) {
+		free(cache_flags);
+	}
+	cache_flags = opt_flags_to_canonical_string(num_dims, dim_flags,
+						    position);
+
+	hash = hash_bytes(hash, &source_hash, sizeof(source_hash));
+	hash = opt_task_hash_string(hash, config->compiler);
+	hash = opt_task_hash_string(hash, config->compiler_version);
+	hash = opt_task_hash_string(hash, config->build_script);
+	hash = opt_task_hash_string(hash, cache_flags);
+	snprintf(cache_key, sizeof(cache_key), "%016llx",
+		 (unsigned long long)hash);
 }
 
-int opt_recv_fitness_from_worker(int *worker, double *fitness)
+/*
+ * Set up the environment and arguments for the stages of one evaluation:
+ * FLAGS in the environment, and any templated arguments filled in.
+ */
+static void opt_task_prepare_evaluation(const char *flags,
+					const int *position)
 {
-	int rc = 0;
-	opt_work_item_t *item = NULL;
-	MPI_Status status;
-
-	rc = MPI_Recv(fitness, 1, MPI_DOUBLE, MPI_ANY_SOURCE, OPT_TASK_MSG_TAG,
-		      MPI_COMM_WORLD, &status);
-	if (rc != MPI_SUCCESS) {
-		log_fatal
-		    ("Receiving message from worker was unsuccessful.  Received code: %d from MPI_Recv",
-		     rc);
-		MPI_Abort(MPI_COMM_WORLD, rc);
+	opt_task_command_t *stage = NULL;
+	const char *slot = getenv("OPTSEARCH_SLOT");
+	char *arg = NULL;
+	int i, n = 0, pos;
+
+	/* Our own environment may change between evaluations (OPTSEARCH_SLOT),
+	 * so take it afresh each time */
+	while (environ[n] != NULL) {
+		n++;
 	}
-	log_debug("taskfarm.c: Received message from worker %d",
-		  status.MPI_SOURCE);
-	*worker = status.MPI_SOURCE;
-	/* TODO Should we not check we are in bounds? */
-	item = working_on_item[*worker];
-	if (item == NULL) {
-		/* Should never get here */
-		log_error
-		    ("Received fitness %lf from worker %d, but this worker doesn't appear to be working on anything!",
-		     fitness, *worker);
-	} else {
-		/* Tell our listener, who should act accordingly (eg adding the next
-		 * position to our work queue, or telling us to stop work). */
-		if (fitness == NULL) {
-			log_error
-			    ("Not sure what is going on, but we got a NULL fitness from worker %d for particle %d",
-			     worker, item->uid);
+	eval_env = realloc(eval_env, (n + 2) * sizeof(*eval_env));
+	eval_flags_env = realloc(eval_flags_env, strlen(flags) + 7);
+	if (eval_env == NULL || eval_flags_env == NULL) {
+		log_fatal("Unable to allocate memory for the environment");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	sprintf(eval_flags_env, "FLAGS=%s", flags);
+	n = 0;
+	for (i = 0; environ[i] != NULL; i++) {
+		if (strncmp(environ[i], "FLAGS=", 6) != 0) {
+			eval_env[n++] = environ[i];
 		}
-		log_trace("taskfarm.c: Updating particle %d with fitness %lf",
-			  item->uid, *fitness);
-		update_fitness(item->uid, *fitness, false);
-
-		/* Clean up now we're finished with this item */
-		free(item->command);
-		free(item);
+	}
+	eval_env[n++] = eval_flags_env;
+	eval_env[n] = NULL;
+	if (use_build_cache) {
+		opt_task_set_cache_key(position);
 	}
 
-	working_on_item[*worker] = NULL;	/* No work right now */
-
-	/* This is kind of redundant */
-	return rc;
+	for (pos = CLEAN_POS; pos <= BENCH_POS; pos++) {
+		stage = &stage_command[pos];
+		if (!stage->templated) {
+			continue;
+		}
+		for (i = 0; stage->argv[i] != NULL; i++) {
+			if (stage->args[i] != stage->argv[i]) {
+				free(stage->args[i]);
+			}
+			arg = opt_task_fill_template(stage->argv[i], "{flags}",
+						     flags);
+			stage->args[i] = opt_task_fill_template(arg, "{slot}",
+								slot != NULL ?
+								slot : "");
+			free(arg);
+		}
+	}
 }
 
-int opt_task_get_next_idle_worker(void)
-{
+/*
+ * Note in result how a run of a stage went: that it got this far, how it
+ * ended, and what it used, adding to anything from earlier runs.
+ */
+static void opt_task_record_stage(opt_task_result_t * result,
+				  opt_task_position_e pos,
+				  const opt_command_usage_t * usage)
+{
+	result->stage = pos;
+	result->status = usage->status;
+	result->signal = usage->signal;
+	result->timed_out = usage->timed_out;
+	if (usage->wall_time < DBL_MAX) {
+		result->wall_time[pos] += usage->wall_time;
+	}
+	result->user_time[pos] += usage->user_time;
+	result->system_time[pos] += usage->system_time;
+	result->max_rss[pos] = MAX(result->max_rss[pos], usage->max_rss);
+}
+
+/* Run one stage of an evaluation, as set up by opt_task_prepare_evaluation */
+static int opt_task_run_stage(opt_task_position_e pos,
+			      opt_task_result_t * result, int timeout)
+{
+	opt_command_usage_t usage;
+	int retval;
+
+	retval = run_command_usage(stage_command[pos].args, eval_env, &usage,
+				   timeout);
+	opt_task_record_stage(result, pos, &usage);
+	return retval;
+}
+
+/* Ready a result to be filled in by the stages of an evaluation */
+static void opt_task_clear_result(opt_task_result_t * result)
+{
+	memset(result, 0, sizeof(*result));
+	result->fitness = result->mean = DBL_MAX;
+	result->load = result->busy = result->freq = -1.0;
+	result->stage = QUIT_POS;
+	result->status = -1;
+}
+
+/*
+ * The measurement of a benchmark run that config->fitness_metric asks for.
+ * Where the hardware counters cannot be had, as in many VMs, this falls
+ * back on the task clock, then on CPU time from rusage; the fallback is
+ * the same for every run, so the fitnesses stay comparable.
+ */
+static double opt_task_fitness_of(const opt_command_usage_t * usage)
+{
+	static bool warned = false;
+
+	switch (config->fitness_metric) {
+	case OPT_METRIC_CYCLES:
+		if (usage->cycles >= 0.0) {
+			return usage->cycles;
+		}
+		/* Fall through */
+	case OPT_METRIC_INSTRUCTIONS:
+		if (config->fitness_metric == OPT_METRIC_INSTRUCTIONS
+		    && usage->instructions >= 0.0) {
+			return usage->instructions;
+		}
+		/* Fall through */
+	case OPT_METRIC_TASK_CLOCK:
+		if (usage->task_clock >= 0.0) {
+			if (config->fitness_metric != OPT_METRIC_TASK_CLOCK
+			    && !warned) {
+				log_warn("Hardware counters are not available, so using the task clock as fitness");
+				warned = true;
+			}
+			return usage->task_clock;
+		}
+		if (!warned) {
+			log_warn("Performance counters are not available, so using CPU time as fitness");
+			warned = true;
+		}
+		return usage->user_time + usage->system_time;
+	case OPT_METRIC_CPU_TIME:
+		return usage->user_time + usage->system_time;
+	case OPT_METRIC_USER_TIME:
+		return usage->user_time;
+	case OPT_METRIC_MAX_RSS:
+		return usage->max_rss;
+	case OPT_METRIC_WALL_TIME:
+	default:
+		return usage->wall_time;
+	}
+}
+
+/*
+ * An opt_task_result_t is a block of doubles, the build's hash and a block
+ * of ints, resized to the struct so that arrays of them work too.
+ */
+static void opt_task_commit_result_type(void)
+{
+	int lengths[3];
+	MPI_Aint displacements[3];
+	MPI_Datatype types[3] = { MPI_DOUBLE, MPI_UINT64_T, MPI_INT };
+	MPI_Datatype blocks;
+
+	if (result_type != MPI_DATATYPE_NULL) {
+		return;
+	}
+	displacements[0] = offsetof(opt_task_result_t, fitness);
+	lengths[0] = (offsetof(opt_task_result_t, build_hash) -
+		      offsetof(opt_task_result_t, fitness)) / sizeof(double);
+	displacements[1] = offsetof(opt_task_result_t, build_hash);
+	lengths[1] = 1;
+	displacements[2] = offsetof(opt_task_result_t, seq);
+	lengths[2] = (offsetof(opt_task_result_t, num_samples) + sizeof(int) -
+		      offsetof(opt_task_result_t, seq)) / sizeof(int);
+	MPI_Type_create_struct(3, lengths, displacements, types, &blocks);
+	MPI_Type_create_resized(blocks, 0, sizeof(opt_task_result_t),
+				&result_type);
+	MPI_Type_commit(&result_type);
+	MPI_Type_free(&blocks);
+}
+
+/* The result of a build with this hash, if it is known, or NULL */
+static const opt_task_result_t *opt_task_find_build(uint64_t hash)
+{
+	opt_task_known_build_t *known = NULL;
+
+	for (known = known_builds; known != NULL; known = known->next) {
+		if (known->result.build_hash == hash) {
+			return &known->result;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Keep the result of a build that was hashed, once it says how the build
+ * fares: that it failed the accuracy test, or how it did in the benchmark.
+ * A builder's successful test says nothing yet.
+ */
+static void opt_task_remember_build(const opt_task_result_t * result)
+{
+	opt_task_known_build_t *known = NULL;
+
+	if (result->build_hash == 0 || result->reused
+	    || !(result->stage == BENCH_POS
+		 || (result->stage == TEST_POS && result->fitness == DBL_MAX))
+	    || opt_task_find_build(result->build_hash) != NULL) {
+		return;
+	}
+	known = malloc(sizeof(*known));
+	if (known == NULL) {
+		log_fatal("Unable to allocate memory to keep a build's result.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	known->result = *result;
+	known->next = known_builds;
+	known_builds = known;
+}
+
+static void opt_task_forget_builds(void)
+{
+	opt_task_known_build_t *known = NULL;
+
+	while (known_builds != NULL) {
+		known = known_builds;
+		known_builds = known->next;
+		free(known);
+	}
+}
+
+/*
+ * The master decides whether builds can be cached, and hashes the source
+ * for the workers.  Without config->source_dir, the builds are only told
+ * apart by compiler and flags, so the cache must not outlive the source.
+ */
+static void opt_task_init_build_cache(int my_rank)
+{
+	int enabled = 0;
+
+	source_hash = OPT_HASH_INIT;
+	if (MASTER == my_rank && (config->build_cache != NULL
+				  || config->shared_build_cache != NULL)) {
+		if (config->artifact_dir == NULL) {
+			log_warn("A build cache needs artifact-dir to say what to keep, so builds will not be cached");
+		} else if (config->source_dir != NULL
+			   && hash_tree(config->source_dir, &source_hash) != 0) {
+			log_warn("Unable to hash the source in %s, so builds will not be cached",
+				 config->source_dir);
+		} else {
+			if (config->source_dir == NULL) {
+				log_warn("No source-dir given, so cached builds are only told apart by compiler and flags");
+			}
+			log_info("Caching builds of source with hash %016llx",
+				 (unsigned long long)source_hash);
+			enabled = 1;
+		}
+	}
+	MPI_Bcast(&enabled, 1, MPI_INT, MASTER, MPI_COMM_WORLD);
+	MPI_Bcast(&source_hash, 1, MPI_UINT64_T, MASTER, MPI_COMM_WORLD);
+	use_build_cache = enabled;
+}
+
+int opt_task_initialise(opt_config_t * conf, int dims, const int *flag_uids,
+			int (*report_fitness) (const int, double, int))
+{
+	int i, my_rank, size;
+	int *uids = NULL;
+
+	log_trace("taskfarm.c: Entered opt_task_initialise in taskfarm.c");
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	msg_sequence = 0;
+	config = conf;
+
+	/* Workers turn the positions they are sent into flags themselves, so
+	 * they need to know which flag each dimension is. */
+	if (MASTER == my_rank) {
+		num_dims = dims;
+	}
+	MPI_Bcast(&num_dims, 1, MPI_INT, MASTER, MPI_COMM_WORLD);
+	uids = malloc((num_dims + 1) * sizeof(*uids));
+	dim_flags = malloc((num_dims + 1) * sizeof(*dim_flags));
+	if (uids == NULL || dim_flags == NULL) {
+		log_fatal("Unable to allocate memory for search space flags.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	if (MASTER == my_rank && num_dims > 0) {
+		memcpy(uids, flag_uids, num_dims * sizeof(*uids));
+	}
+	MPI_Bcast(uids, num_dims, MPI_INT, MASTER, MPI_COMM_WORLD);
+	for (i = 0; i < num_dims; i++) {
+		dim_flags[i] = opt_config_get_flag(config, uids[i]);
+		if (dim_flags[i] == NULL) {
+			log_fatal("Dimension %d refers to unknown flag %d", i,
+				  uids[i]);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+	}
+	free(uids);
+
+	if (MASTER == my_rank) {
+		queue_size = 0;
+		queue_front = NULL;
+		queue_back = NULL;
+		log_trace("taskfarm.c: size is %d", size);
+		working_on_item = malloc(size * sizeof(*working_on_item));
+		worker_state = malloc(size * sizeof(*worker_state));
+		result_request = malloc(4 * size * sizeof(*result_request));
+		result_buffer = malloc(size * sizeof(*result_buffer));
+		in_flight = malloc(size * sizeof(*in_flight));
+		bench_buffer = malloc(size * sizeof(*bench_buffer));
+		wants_benchmark = malloc(size * sizeof(*wants_benchmark));
+		bench_requested = malloc(size * sizeof(*bench_requested));
+		heartbeat_buffer = malloc(size * sizeof(*heartbeat_buffer));
+		last_heard = malloc(size * sizeof(*last_heard));
+		node_of_rank = malloc(size * sizeof(*node_of_rank));
+		node_benchmarking = malloc(size * sizeof(*node_benchmarking));
+		build_buffer = malloc(size * sizeof(*build_buffer));
+		if (working_on_item == NULL || worker_state == NULL
+		    || result_request == NULL || result_buffer == NULL
+		    || in_flight == NULL || bench_buffer == NULL
+		    || wants_benchmark == NULL || node_of_rank == NULL
+		    || node_benchmarking == NULL || bench_requested == NULL
+		    || heartbeat_buffer == NULL || last_heard == NULL
+		    || build_buffer == NULL) {
+			log_fatal
+			    ("Unable to allocate memory to keep track of workers.");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		for (i = 0; i < size; i++) {
+			working_on_item[i] = NULL;
+			worker_state[i] = OPT_TASK_WAITING;
+			result_request[i] = MPI_REQUEST_NULL;
+			result_buffer[i].fitness = DBL_MAX;
+			in_flight[i] = 0;
+			wants_benchmark[i] = false;
+			bench_requested[i] = 0.0;
+			node_benchmarking[i] = -1;
+			last_heard[i] = 0.0;
+		}
+		if (size == 1) {
+			opt_task_alloc_slots(config->local_slots > 0 ?
+					     config->local_slots :
+					     (int)sysconf(_SC_NPROCESSORS_ONLN));
+		}
+		bench_request = result_request + size;
+		heartbeat_request = result_request + 2 * size;
+		build_request = result_request + 3 * size;
+		for (i = 0; i < size; i++) {
+			bench_request[i] = MPI_REQUEST_NULL;
+			heartbeat_request[i] = MPI_REQUEST_NULL;
+			build_request[i] = MPI_REQUEST_NULL;
+		}
+		update_fitness = report_fitness;
+	} else {
+		/* I'm doing this on purpose so that we have an error if a worker
+		 * calls it by mistake, which should never happen */
+		update_fitness = NULL;
+	}
+
+	opt_task_discover_nodes(my_rank, size);
+	opt_task_prepare_commands();
+	opt_task_init_build_cache(my_rank);
+	/* Builds from an earlier run of the task farm may not be the same */
+	opt_task_forget_builds();
+	opt_task_commit_result_type();
+
+	return 0;
+}
+
+void opt_task_set_priority(double (*priority) (const int))
+{
+	item_priority = priority;
+}
+
+void opt_task_set_result_listener(void (*listener)
+				   (const int, const int *,
+				    const opt_task_result_t *))
+{
+	result_listener = listener;
+}
+
+static double opt_task_predict_cost(int uid)
+{
+	if (uid >= 0 && uid < uid_cost_size && uid_cost[uid] > 0.0) {
+		return uid_cost[uid];
+	}
+	if (num_costs > 0) {
+		return total_cost / num_costs;
+	}
+	return 0.0;
+}
+
+static void opt_task_record_cost(int uid, double elapsed)
+{
 	int i;
-	int num_workers;
-	MPI_Comm_size(MPI_COMM_WORLD, &num_workers);
-	/* Master does not do work itself */
-	num_workers--;
-	for (i = 1; i <= num_workers; i++) {
-		if (working_on_item[i] == NULL
-		    && worker_state[i] == OPT_TASK_WAITING) {
-			return i;
+
+	if (uid < 0 || elapsed <= 0.0) {
+		return;
+	}
+	if (uid >= uid_cost_size) {
+		uid_cost = realloc(uid_cost, (uid + 1) * sizeof(*uid_cost));
+		if (uid_cost == NULL) {
+			log_fatal("Unable to allocate memory for timings");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		for (i = uid_cost_size; i <= uid; i++) {
+			uid_cost[i] = 0.0;
+		}
+		uid_cost_size = uid + 1;
+	}
+	if (uid_cost[uid] > 0.0) {
+		uid_cost[uid] = OPT_TASK_COST_SMOOTHING * elapsed +
+		    (1.0 - OPT_TASK_COST_SMOOTHING) * uid_cost[uid];
+	} else {
+		uid_cost[uid] = elapsed;
+	}
+	total_cost += elapsed;
+	num_costs++;
+}
+
+static int opt_task_compare_times(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * built is set for a builder's successful build, whose fitness is only its
+ * build time, standing in until a benchmarker gives the real one.  It is
+ * given to the listener now, without a fitness; any other result is given
+ * to it by opt_task_finish_item.
+ */
+static void opt_task_record_result(const opt_work_item_t * item,
+				   const opt_task_result_t * result,
+				   bool built)
+{
+	opt_task_result_t recorded;
+
+	if ((built || result->fitness < DBL_MAX)
+	    && result->wall_time[BUILD_POS] > 0.0) {
+		/* Only builds that worked say how long the next should take */
+		build_times[num_build_times % OPT_TASK_BUILD_HISTORY] =
+		    result->wall_time[BUILD_POS];
+		num_build_times++;
+	}
+	if (result->bench_time > 0.0) {
+		log_debug("taskfarm.c: Fitness %e measured with the node %.0f%% busy, load %.2f, at %.0fMHz.",
+			  result->fitness, result->busy, result->load,
+			  result->freq);
+	}
+	if (result->bench_time > 0.0 && result->fitness < best_fitness) {
+		best_fitness = result->fitness;
+		best_bench_time = result->bench_time;
+		best_mean = result->mean;
+		best_stddev = result->stddev;
+		best_repeats = result->repeats;
+	}
+	opt_task_remember_build(result);
+	if (built && result_listener != NULL) {
+		recorded = *result;
+		recorded.fitness = DBL_MAX;
+		result_listener(item->uid, item->position, &recorded);
+	}
+}
+
+/*
+ * Timeouts are whole seconds, and never longer than those configured; they
+ * are rounded up, so a quick stage is still given at least a second.
+ */
+static int opt_task_limit_timeout(double adaptive, int configured)
+{
+	adaptive = ceil(adaptive);
+	if (adaptive < 1.0) {
+		adaptive = 1.0;
+	}
+	if (configured > 0 && adaptive >= configured) {
+		return configured;
+	}
+	return (int)adaptive;
+}
+
+/*
+ * A benchmark run may take benchmark_timeout_factor times as long as one of
+ * the best result so far.  Anything slower than that is not going to be the
+ * new best, so there is no point waiting for it.
+ */
+static int opt_task_bench_timeout(void)
+{
+	if (config->benchmark_timeout_factor <= 0.0
+	    || best_bench_time == DBL_MAX) {
+		return config->benchmark_timeout;
+	}
+	return opt_task_limit_timeout(config->benchmark_timeout_factor *
+				      best_bench_time,
+				      config->benchmark_timeout);
+}
+
+/*
+ * A build may take as long as the build_timeout_percentile of the recent
+ * successful builds.  The same source built with different flags takes
+ * roughly as long each time, so one that takes far longer has usually hung
+ * or sent the compiler into some pathological case.
+ */
+static int opt_task_build_timeout(void)
+{
+	double sorted[OPT_TASK_BUILD_HISTORY];
+	int n, i;
+
+	n = MIN(num_build_times, OPT_TASK_BUILD_HISTORY);
+	if (config->build_timeout_percentile <= 0
+	    || n < OPT_TASK_MIN_BUILD_HISTORY) {
+		return config->timeout;
+	}
+	memcpy(sorted, build_times, n * sizeof(*sorted));
+	qsort(sorted, n, sizeof(*sorted), opt_task_compare_times);
+	i = (int)ceil(MIN(config->build_timeout_percentile, 100) / 100.0 * n) - 1;
+	return opt_task_limit_timeout(sorted[MAX(i, 0)], config->timeout);
+}
+
+/*
+ * Fill in what the master decides as it hands out an item: the timeouts,
+ * and the incumbent to race against.
+ */
+static void opt_task_stamp_header(opt_work_item_t * item)
+{
+	opt_task_incumbent_t incumbent;
+
+	item->message[OPT_HEADER_BUILD_TIMEOUT] = opt_task_build_timeout();
+	item->message[OPT_HEADER_BENCH_TIMEOUT] = opt_task_bench_timeout();
+	incumbent.mean = best_mean;
+	incumbent.stddev = best_stddev;
+	incumbent.repeats = best_fitness < DBL_MAX ? best_repeats : 0.0;
+	memcpy(item->message + OPT_HEADER_INCUMBENT, &incumbent,
+	       sizeof(incumbent));
+}
+
+/*
+ * Should a be handed out before b, according to the configured scheduler?
+ * Ties go to whichever was queued first, so each policy falls back to FIFO.
+ */
+static bool opt_task_goes_before(opt_work_item_t * a, opt_work_item_t * b)
+{
+	if (a->speculative != b->speculative) {
+		return b->speculative;
+	}
+	switch (config->scheduler) {
+	case OPT_SCHEDULER_BEST_FIRST:
+		return a->priority < b->priority;
+	case OPT_SCHEDULER_COST_AWARE:
+		return a->cost > b->cost;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Remove and return the next item from a queue, according to the
+ * configured scheduler.  Queues are short (about the size of the swarm), so
+ * a scan is fine.  Speculative items are only considered if
+ * with_speculative is set; if there is nothing else, NULL is returned.
+ */
+static opt_work_item_t *opt_task_take(opt_work_item_t ** front,
+				      opt_work_item_t ** back, int *size,
+				      bool with_speculative)
+{
+	opt_work_item_t *item = NULL;
+	opt_work_item_t *prev = NULL;
+	opt_work_item_t *best = NULL;
+	opt_work_item_t *best_prev = NULL;
+
+	for (prev = NULL, item = *front; item != NULL;
+	     prev = item, item = item->next) {
+		if (item->speculative && !with_speculative) {
+			continue;
+		}
+		if (best == NULL || opt_task_goes_before(item, best)) {
+			best = item;
+			best_prev = prev;
+		}
+	}
+	if (best == NULL) {
+		return NULL;
+	}
+
+	if (best_prev == NULL) {
+		*front = best->next;
+	} else {
+		best_prev->next = best->next;
+	}
+	if (*back == best) {
+		*back = best_prev;
+	}
+	best->next = NULL;
+	(*size)--;
+	return best;
+}
+
+opt_work_item_t *opt_queue_pop(void)
+{
+	log_trace("taskfarm.c: Entered opt_queue_pop in taskfarm.c");
+	return opt_task_take(&queue_front, &queue_back, &queue_size, true);
+}
+
+static void opt_task_bench_queue_push(opt_work_item_t * item)
+{
+	item->next = NULL;
+	if (bench_queue_front == NULL) {
+		bench_queue_front = item;
+	}
+	if (bench_queue_back != NULL) {
+		bench_queue_back->next = item;
+	}
+	bench_queue_back = item;
+	bench_queue_size++;
+	wake_master = 1;
+}
+
+static opt_work_item_t *opt_task_bench_queue_pop(bool with_speculative)
+{
+	return opt_task_take(&bench_queue_front, &bench_queue_back,
+			     &bench_queue_size, with_speculative);
+}
+
+static int opt_queue_push_item(const int work_item_uid, const int *position,
+			       bool speculative)
+{
+	int my_rank;
+	opt_work_item_t *work = NULL;
+	log_trace("taskfarm.c: Entered opt_queue_push in taskfarm.c");
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+
+	/* We should only get called if we are rank 0, so the check should be
+	 * unnecessary */
+	if (MASTER == my_rank) {
+		/* TODO We should be checking that malloc and realloc are successful */
+		errno = 0;
+		work = malloc(sizeof(*work));
+		if (work == NULL) {
+			if (errno == ENOMEM) {
+				log_error("Out of memory.");
+			}
+			log_fatal
+			    ("Unable to allocate memory for addition of work item to queue.");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		/* The header and position are kept together, so that they can be
+		 * sent as a single message */
+		work->message =
+		    malloc((OPT_HEADER_LENGTH + num_dims) * sizeof(int));
+		if (work->message == NULL) {
+			log_fatal
+			    ("Unable to allocate memory for addition of work item to queue.");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		work->message[OPT_HEADER_TYPE] = OPT_TASK_WORK_MSG;
+		work->message[OPT_HEADER_UID] = work_item_uid;
+		work->message[OPT_HEADER_SIZE] = num_dims;
+		work->message[OPT_HEADER_SEQ] = 0;
+		work->message[OPT_HEADER_ARTIFACT] = 0;
+		work->message[OPT_HEADER_BUILD_TIMEOUT] = 0;
+		work->message[OPT_HEADER_BENCH_TIMEOUT] = 0;
+		memset(work->message + OPT_HEADER_INCUMBENT, 0,
+		       OPT_INCUMBENT_INTS * sizeof(int));
+		work->position = work->message + OPT_HEADER_LENGTH;
+		memcpy(work->position, position, num_dims * sizeof(int));
+		work->uid = work_item_uid;
+		work->request = MPI_REQUEST_NULL;
+		work->artifact = NULL;
+		work->artifact_size = 0;
+		work->artifact_request = MPI_REQUEST_NULL;
+		work->priority =
+		    item_priority == NULL ? 0.0 : item_priority(work_item_uid);
+		work->cost = opt_task_predict_cost(work_item_uid);
+		work->started = 0.0;
+		work->elapsed = 0.0;
+		work->deadline = DBL_MAX;
+		work->speculative = speculative;
+		work->build_hash = 0;
+		work->next = NULL;
+
+		if (queue_front == NULL) {
+			queue_front = work;
+		}
+		if (queue_back != NULL) {
+			queue_back->next = work;
+		}
+		queue_back = work;
+		queue_size++;
+		wake_master = 1;
+
+		return queue_size;
+	}
+	return 0;
+}
+
+int opt_queue_push(const int work_item_uid, const int *position)
+{
+	return opt_queue_push_item(work_item_uid, position, false);
+}
+
+int opt_queue_push_speculative(const int work_item_uid, const int *position)
+{
+	return opt_queue_push_item(work_item_uid, position, true);
+}
+
+/* How many items each MPI worker can be running at once */
+static int opt_task_worker_slots(void)
+{
+	return MAX(config->slots_per_worker, 1);
+}
+
+int opt_task_get_num_workers(void)
+{
+	int size;
+
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	return size == 1 ? num_slots : (size - 1) * opt_task_worker_slots();
+}
+
+void opt_task_set_idle_listener(void (*on_idle) (int))
+{
+	idle_listener = on_idle;
+}
+
+int opt_task_stop(void)
+{
+	/* Signal that the task farm should stop work */
+	stop_work = true;
+	wake_master = 1;
+	return 0;
+}
+
+int opt_task_clean_up(void)
+{
+	int my_rank, size, i;
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	log_trace("taskfarm.c: Entered opt_task_clean_up in taskfarm.c");
+	opt_work_item_t *item = NULL;
+
+	/*
+	 * TODO notify workers if we hadn't been intending to stop before.
+	 */
+
+	if (!stop_work) {
+		log_warn
+		    ("Have not been told to stop, but the clean_up function has been called");
+		opt_task_stop();
+	}
+
+	/*
+	 * FIXME Calling free seems to cause a double free later, as
+	 * MPI_Finalize() appears to struggle to work out what needs to be free'd
+	 * and frees things incorrectly.  It doesn't affect all our allocated
+	 * memory, but does affect a lot of it.  What is and is not affected is
+	 * unpredictable, and seems to change with the version of OpenMPI we are
+	 * using, so I am just commenting out this entire section.  It causes too
+	 * many problems otherwise.
+	 */
+	/*
+	   if (MASTER == my_rank) {
+		   item = queue_front;
+		   while (item != NULL) {
+		   if (item->message != NULL)
+			   free(item->message);
+			   item->message = NULL;
+			   free(item);
+			   item = NULL;
+			   item = opt_queue_pop();
+		   }
+		   queue_front = NULL;
+		   MPI_Comm_size(MPI_COMM_WORLD, &size);
+		   for (i = 1; i < size; i++) {
+			   working_on_item[i] = NULL;
+		   }
+		   //free(working_on_item);
+		   working_on_item = NULL;
+		   free(worker_state);
+	   }
+	 */
+
+	return 0;		/* TODO Return something more useful */
+}
+
+static void opt_task_post_result_receive(int worker)
+{
+	int rc;
+
+	rc = MPI_Irecv(&result_buffer[worker], 1, result_type, worker,
+		       OPT_TASK_MSG_TAG, MPI_COMM_WORLD,
+		       &result_request[worker]);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Posting receive for result from worker %d was unsuccessful.  Received code: %d from MPI_Irecv",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+}
+
+static void opt_task_post_bench_receive(int worker)
+{
+	int rc;
+
+	rc = MPI_Irecv(&bench_buffer[worker], 1, MPI_INT, worker,
+		       OPT_TASK_BENCH_REQUEST_TAG, MPI_COMM_WORLD,
+		       &bench_request[worker]);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Posting receive for benchmark request from worker %d was unsuccessful.  Received code: %d from MPI_Irecv",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+}
+
+static void opt_task_post_heartbeat_receive(int worker)
+{
+	int rc;
+
+	rc = MPI_Irecv(&heartbeat_buffer[worker], 1, MPI_INT, worker,
+		       OPT_TASK_HEARTBEAT_TAG, MPI_COMM_WORLD,
+		       &heartbeat_request[worker]);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Posting receive for heartbeat from worker %d was unsuccessful.  Received code: %d from MPI_Irecv",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+}
+
+static void opt_task_post_build_receive(int worker)
+{
+	int rc;
+
+	rc = MPI_Irecv(&build_buffer[worker], 1, MPI_UINT64_T, worker,
+		       OPT_TASK_BUILD_QUERY_TAG, MPI_COMM_WORLD,
+		       &build_request[worker]);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Posting receive for build query from worker %d was unsuccessful.  Received code: %d from MPI_Irecv",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+}
+
+/* A worker's heartbeat has arrived */
+void opt_task_heartbeat_from(int worker)
+{
+	log_trace("taskfarm.c: Heartbeat from worker %d", worker);
+	last_heard[worker] = MPI_Wtime();
+	opt_task_post_heartbeat_receive(worker);
+}
+
+void opt_task_take_heartbeats(void)
+{
+	int worker, size, done = 0;
+
+	if (heartbeat_request == NULL) {
+		return;
+	}
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	for (worker = 1; worker < size; worker++) {
+		if (heartbeat_request[worker] == MPI_REQUEST_NULL) {
+			continue;
+		}
+		MPI_Test(&heartbeat_request[worker], &done, MPI_STATUS_IGNORE);
+		if (done) {
+			opt_task_heartbeat_from(worker);
+		}
+	}
+}
+
+/*
+ * A worker has asked whether its build has been tested and benchmarked
+ * already.  The answer is the result if so, and otherwise a cleared one,
+ * whose build_hash is 0.
+ */
+void opt_task_build_query_from(int worker)
+{
+	const opt_task_result_t *known = NULL;
+	opt_task_result_t reply;
+	int rc;
+
+	last_heard[worker] = MPI_Wtime();
+	known = opt_task_find_build(build_buffer[worker]);
+	if (known != NULL) {
+		log_debug("taskfarm.c: Worker %d's build %016llx has a result already",
+			  worker, (unsigned long long)build_buffer[worker]);
+		reply = *known;
+	} else {
+		opt_task_clear_result(&reply);
+	}
+	opt_task_post_build_receive(worker);
+	/* The worker is blocked waiting for this, so it will not block us */
+	rc = MPI_Send(&reply, 1, result_type, worker, OPT_TASK_BUILD_REPLY_TAG,
+		      MPI_COMM_WORLD);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Answering build query from worker %d was unsuccessful.  Received code: %d from MPI_Send",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+}
+
+/*
+ * Worker side: called while we wait for our commands (see
+ * set_child_wait_hook) or for permission to benchmark.  If it is time for
+ * another heartbeat, and the master has taken the last one, send it.
+ */
+static void opt_task_heartbeat(void)
+{
+	static int beat = 0;
+	int done = 1;
+
+	if (config->heartbeat_interval <= 0
+	    || MPI_Wtime() - last_heartbeat < config->heartbeat_interval) {
+		return;
+	}
+	if (heartbeat_send != MPI_REQUEST_NULL) {
+		MPI_Test(&heartbeat_send, &done, MPI_STATUS_IGNORE);
+	}
+	if (done) {
+		beat++;
+		MPI_Isend(&beat, 1, MPI_INT, MASTER, OPT_TASK_HEARTBEAT_TAG,
+			  MPI_COMM_WORLD, &heartbeat_send);
+		last_heartbeat = MPI_Wtime();
+	}
+}
+
+static void opt_task_grant_benchmark(int worker)
+{
+	int rc;
+	int node = node_of_rank[worker];
+
+	log_trace("taskfarm.c: Worker %d may run its benchmark on node %d",
+		  worker, node);
+	wants_benchmark[worker] = false;
+	node_benchmarking[node] = worker;
+	/* Time spent waiting for the node does not count against the worker */
+	if (working_on_item[worker] != NULL) {
+		working_on_item[worker]->deadline +=
+		    MPI_Wtime() - bench_requested[worker];
+	}
+	/* The worker is blocked waiting for this, so it will not block us */
+	rc = MPI_Send(&bench_buffer[worker], 1, MPI_INT, worker,
+		      OPT_TASK_BENCH_GRANT_TAG, MPI_COMM_WORLD);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Granting benchmark to worker %d was unsuccessful.  Received code: %d from MPI_Send",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+}
+
+/*
+ * A worker has asked to start its benchmark.  Let it, unless another worker
+ * on the same node is already benchmarking, in which case it has to wait
+ * until that one reports its result.
+ */
+void opt_task_request_benchmark(int worker)
+{
+	int node = node_of_rank[worker];
+
+	last_heard[worker] = bench_requested[worker] = MPI_Wtime();
+	opt_task_post_bench_receive(worker);
+	if (node_benchmarking[node] < 0) {
+		opt_task_grant_benchmark(worker);
+	} else {
+		log_trace
+		    ("taskfarm.c: Worker %d must wait for worker %d to finish benchmarking on node %d",
+		     worker, node_benchmarking[node], node);
+		wants_benchmark[worker] = true;
+	}
+}
+
+/*
+ * Called when a worker reports a result.  If it was benchmarking, the node
+ * is free for the next worker on it that is waiting to benchmark.
+ */
+static void opt_task_release_benchmark(int worker)
+{
+	int i, size;
+	int node = node_of_rank[worker];
+
+	if (node_benchmarking[node] != worker) {
+		/* Probably failed to build, so never asked */
+		return;
+	}
+	node_benchmarking[node] = -1;
+
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	for (i = 1; i < size; i++) {
+		if (wants_benchmark[i] && node_of_rank[i] == node) {
+			opt_task_grant_benchmark(i);
+			break;
+		}
+	}
+}
+
+/*
+ * Worker side: wait for the master to answer something we asked.  This may
+ * take a while, so keep up the heartbeats.
+ */
+static void opt_task_wait_for_master(MPI_Request * request)
+{
+	int done = 0;
+	long delay = 0;
+	struct timespec pause;
+
+	for (;;) {
+		MPI_Test(request, &done, MPI_STATUS_IGNORE);
+		if (done) {
+			break;
+		}
+		opt_task_heartbeat();
+		delay = MIN(OPT_TASK_MAX_WAIT_US,
+			    MAX(OPT_TASK_MIN_WAIT_US, delay * 2));
+		pause.tv_sec = 0;
+		pause.tv_nsec = delay * 1000;
+		nanosleep(&pause, NULL);
+	}
+}
+
+/*
+ * Worker side of exclusive benchmarking: ask the master whether we may
+ * start, and block until we may.
+ */
+static void opt_task_acquire_benchmark(int uid)
+{
+	int grant = 0;
+	MPI_Request request = MPI_REQUEST_NULL;
+
+	if (!config->exclusive_benchmark) {
+		return;
+	}
+	log_trace("taskfarm.c: Asking master to start benchmark for %d", uid);
+	MPI_Irecv(&grant, 1, MPI_INT, MASTER, OPT_TASK_BENCH_GRANT_TAG,
+		  MPI_COMM_WORLD, &request);
+	MPI_Send(&uid, 1, MPI_INT, MASTER, OPT_TASK_BENCH_REQUEST_TAG,
+		 MPI_COMM_WORLD);
+	opt_task_wait_for_master(&request);
+}
+
+/*
+ * Worker side of config->artifact_glob: ask the master whether a build
+ * with this hash has been tested and benchmarked already, and block until
+ * it answers.  A slot cannot ask, so looks in its copy of the list instead.
+ * Returns true, with the result in known, if so.
+ */
+static bool opt_task_lookup_build(uint64_t hash, opt_task_result_t * known)
+{
+	const opt_task_result_t *found = NULL;
+	MPI_Request request = MPI_REQUEST_NULL;
+
+	if (in_slot) {
+		found = opt_task_find_build(hash);
+		if (found != NULL) {
+			*known = *found;
+		}
+		return found != NULL;
+	}
+	log_trace("taskfarm.c: Asking master about build %016llx",
+		  (unsigned long long)hash);
+	MPI_Irecv(known, 1, result_type, MASTER, OPT_TASK_BUILD_REPLY_TAG,
+		  MPI_COMM_WORLD, &request);
+	MPI_Send(&hash, 1, MPI_UINT64_T, MASTER, OPT_TASK_BUILD_QUERY_TAG,
+		 MPI_COMM_WORLD);
+	opt_task_wait_for_master(&request);
+	return known->build_hash != 0;
+}
+
+/*
+ * Hash what has just been built, and if the same build has been tested
+ * and benchmarked already, take its result: the fitness and how it was
+ * measured, and the stage it reached.  The times of the stages are left as
+ * they are, since those stages were not run here.  Returns true if so.
+ */
+static bool opt_task_reuse_build(opt_task_result_t * result)
+{
+	static bool warned = false;
+	opt_task_result_t known;
+	uint64_t hash = OPT_HASH_INIT;
+	int count;
+
+	count = hash_build_files(config->artifact_glob, &hash);
+	if (count <= 0) {
+		if (count == 0 && !warned) {
+			log_warn("No files match artifact-glob %s, so builds cannot be compared",
+				 config->artifact_glob);
+			warned = true;
+		}
+		return false;
+	}
+	/* 0 means not hashed */
+	result->build_hash = hash != 0 ? hash : 1;
+	if (!opt_task_lookup_build(result->build_hash, &known)) {
+		return false;
+	}
+	log_debug("taskfarm.c: Build %016llx has been benchmarked already, with fitness %e.",
+		  (unsigned long long)result->build_hash, known.fitness);
+	result->fitness = known.fitness;
+	result->bench_time = known.bench_time;
+	result->stddev = known.stddev;
+	result->mean = known.mean;
+	result->load = known.load;
+	result->busy = known.busy;
+	result->freq = known.freq;
+	memcpy(result->samples, known.samples, sizeof(result->samples));
+	result->stage = known.stage;
+	result->status = known.status;
+	result->signal = known.signal;
+	result->timed_out = known.timed_out;
+	result->noisy = known.noisy;
+	result->repeats = known.repeats;
+	result->num_samples = known.num_samples;
+	result->reused = 1;
+	return true;
+}
+
+/*
+ * Receive an archived build, from a builder (on the master) or from the
+ * master (on a benchmarker).
+ */
+static void opt_task_receive_artifact(int source, opt_work_item_t * item)
+{
+	int rc;
+	MPI_Message message;
+	MPI_Status status;
+
+	rc = MPI_Mprobe(source, OPT_TASK_ARTIFACT_TAG, MPI_COMM_WORLD,
+			&message, &status);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Probing for build from rank %d was unsuccessful.  Received code: %d from MPI_Mprobe",
+		     source, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	MPI_Get_count(&status, MPI_BYTE, &item->artifact_size);
+	item->artifact = realloc(item->artifact, item->artifact_size + 1);
+	if (item->artifact == NULL) {
+		log_fatal("Unable to allocate %d bytes for build from rank %d",
+			  item->artifact_size, source);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	rc = MPI_Mrecv(item->artifact, item->artifact_size, MPI_BYTE,
+		       &message, &status);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Receiving build from rank %d was unsuccessful.  Received code: %d from MPI_Mrecv",
+		     source, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	log_trace("taskfarm.c: Received build of %d bytes from rank %d",
+		  item->artifact_size, source);
+}
+
+/*
+ * Work items are a header followed by the position, the length of which
+ * we only know once the message has arrived, so we probe for it first.
+ * Matched probes ensure nothing else can receive the message between
+ * probing it and receiving it.  This receives the probed message.
+ */
+static opt_task_msg_t opt_task_receive_probed(MPI_Message * message,
+					      MPI_Status * status,
+					      opt_work_item_t * item)
+{
+	int rc = 0;
+	int count = 0;
+
+	MPI_Get_count(status, MPI_INT, &count);
+	if (count < OPT_HEADER_LENGTH) {
+		log_fatal("Message from master is too short (%d ints)", count);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	item->message = realloc(item->message, count * sizeof(int));
+	if (item->message == NULL) {
+		log_fatal("Unable to allocate memory for work item");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	rc = MPI_Mrecv(item->message, count, MPI_INT, message, status);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Receiving message from master was unsuccessful.  Received code: %d from MPI_Mrecv",
+		     rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	log_trace("taskfarm.c: Received message (seq #%d) from master",
+		  item->message[OPT_HEADER_SEQ]);
+
+	if (item->message[OPT_HEADER_TYPE] == OPT_TASK_STOP_MSG) {
+		log_debug("taskfarm.c: Told to stop work by master (msg #%d)",
+			  item->message[OPT_HEADER_SEQ]);
+		stop_work = true;
+	} else {
+		if (item->message[OPT_HEADER_SIZE] != count - OPT_HEADER_LENGTH
+		    || item->message[OPT_HEADER_SIZE] != num_dims) {
+			log_fatal
+			    ("Received position of %d values (seq #%d), but expected %d",
+			     count - OPT_HEADER_LENGTH,
+			     item->message[OPT_HEADER_SEQ], num_dims);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		item->uid = item->message[OPT_HEADER_UID];
+		item->position = item->message + OPT_HEADER_LENGTH;
+		if (item->message[OPT_HEADER_TYPE] == OPT_TASK_BENCH_MSG
+		    && config->staging_dir == NULL) {
+			/* The build follows straight after */
+			opt_task_receive_artifact(MASTER, item);
+		}
+	}
+	return item->message[OPT_HEADER_TYPE];
+}
+
+opt_task_msg_t opt_task_receive_work(opt_work_item_t * item)
+{
+	int rc = 0;
+	MPI_Message message;
+	MPI_Status status;
+
+	rc = MPI_Mprobe(MASTER, OPT_TASK_MSG_TAG, MPI_COMM_WORLD, &message,
+			&status);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Probing for message from master was unsuccessful.  Received code: %d from MPI_Mprobe",
+		     rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	return opt_task_receive_probed(&message, &status, item);
+}
+
+/* As opt_task_receive_work, but returns 0 at once if nothing has come */
+static opt_task_msg_t opt_task_poll_work(opt_work_item_t * item)
+{
+	int rc = 0;
+	int flag = 0;
+	MPI_Message message;
+	MPI_Status status;
+
+	rc = MPI_Improbe(MASTER, OPT_TASK_MSG_TAG, MPI_COMM_WORLD, &flag,
+			 &message, &status);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Probing for message from master was unsuccessful.  Received code: %d from MPI_Improbe",
+		     rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	if (!flag) {
+		return 0;
+	}
+	return opt_task_receive_probed(&message, &status, item);
+}
+
+/*
+ * How long each sample of the node's noise takes while waiting for it to be
+ * quiet, and otherwise.
+ */
+#define OPT_TASK_QUIET_INTERVAL 1.0
+#define OPT_TASK_NOISE_INTERVAL 0.1
+
+/*
+ * The longest an item can take if the worker is alive and its commands are
+ * killed when they should be: the clean, build, test and packing or
+ * unpacking of the build, waiting for the node to be quiet, and every run
+ * of the benchmark, warm-up runs included.  This is an upper bound, as no
+ * item goes through all of these.  With any of the timeouts turned off,
+ * there is no deadline.
+ */
+static double opt_task_item_budget(opt_work_item_t * item)
+{
+	int build = item->message[OPT_HEADER_BUILD_TIMEOUT];
+	int bench = item->message[OPT_HEADER_BENCH_TIMEOUT];
+	double quiet = OPT_TASK_NOISE_INTERVAL;
+
+	if (config->timeout <= 0 || build <= 0 || bench <= 0) {
+		return DBL_MAX;
+	}
+	if (config->quiet_threshold > 0.0) {
+		/* The last sample may start just before the wait is up */
+		quiet = config->quiet_wait + OPT_TASK_QUIET_INTERVAL;
+	}
+	return 3.0 * config->timeout + build + quiet +
+	    (MAX(config->benchmark_repeats, 1) + config->benchmark_warmup) *
+	    (double)bench + OPT_TASK_DEADLINE_GRACE;
+}
+
+static void opt_task_start_item(opt_work_item_t * item)
+{
+	double budget = opt_task_item_budget(item);
+
+	item->started = MPI_Wtime();
+	item->deadline = budget == DBL_MAX ? DBL_MAX : item->started + budget;
+}
+
+int opt_task_send_to_worker(int worker, opt_task_msg_t type,
+			    opt_work_item_t * item)
+{
+	int rc = 0;
+	int seq;
+	int stop_message[OPT_HEADER_LENGTH] = { 0 };
+	opt_work_item_t *last = NULL;
+
+	if (item == NULL && type != OPT_TASK_STOP_MSG) {
+		log_error("Cannot send NULL work item to workers");
+		return 1;
+	}
+
+	seq = opt_get_msg_seq();
+
+	if (type == OPT_TASK_STOP_MSG) {
+		if (working_on_item[worker] != NULL) {
+			log_debug
+			    ("taskfarm.c: Worker %d was still working on something, which is about to be lost (particle uid was %d)",
+			     worker, working_on_item[worker]->uid);
+		}
+		stop_message[OPT_HEADER_TYPE] = type;
+		stop_message[OPT_HEADER_SEQ] = seq;
+		stop_message[OPT_HEADER_SIZE] = 0;
+		log_trace
+		    ("taskfarm.c: Sending message (%d) of type %d to worker rank %d",
+		     seq, type, worker);
+		/* The worker has nothing left to do, so will be waiting for this */
+		rc = MPI_Send(stop_message, OPT_HEADER_LENGTH, MPI_INT, worker,
+			      OPT_TASK_MSG_TAG, MPI_COMM_WORLD);
+		if (rc != MPI_SUCCESS) {
+			log_fatal
+			    ("Sending message (%d) to worker %d was unsuccessful.  Received code: %d from MPI_Send",
+			     seq, worker, rc);
+			MPI_Abort(MPI_COMM_WORLD, rc);
+		}
+		working_on_item[worker] = NULL;
+		worker_state[worker] = OPT_TASK_STOPPED;
+		if (bench_request[worker] != MPI_REQUEST_NULL) {
+			MPI_Cancel(&bench_request[worker]);
+			MPI_Wait(&bench_request[worker], MPI_STATUS_IGNORE);
+		}
+		if (heartbeat_request[worker] != MPI_REQUEST_NULL) {
+			MPI_Cancel(&heartbeat_request[worker]);
+			MPI_Wait(&heartbeat_request[worker], MPI_STATUS_IGNORE);
+		}
+		if (build_request[worker] != MPI_REQUEST_NULL) {
+			MPI_Cancel(&build_request[worker]);
+			MPI_Wait(&build_request[worker], MPI_STATUS_IGNORE);
+		}
+		return rc;
+	}
+
+	item->message[OPT_HEADER_TYPE] = type;
+	item->message[OPT_HEADER_SEQ] = seq;
+	opt_task_stamp_header(item);
+
+	/*
+	 * This is nonblocking because the worker may well be busy with its
+	 * previous item, and so not receiving, for a long time.
+	 */
+	log_trace
+	    ("taskfarm.c: Sending message (%d) with %d values and type %d to worker rank %d",
+	     seq, item->message[OPT_HEADER_SIZE], type, worker);
+	rc = MPI_Isend(item->message,
+		       OPT_HEADER_LENGTH + item->message[OPT_HEADER_SIZE],
+		       MPI_INT, worker, OPT_TASK_MSG_TAG, MPI_COMM_WORLD,
+		       &item->request);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Sending message (%d) to worker %d was unsuccessful.  Received code: %d from MPI_Isend",
+		     seq, worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	if (type == OPT_TASK_BENCH_MSG && item->artifact != NULL) {
+		rc = MPI_Isend(item->artifact, item->artifact_size, MPI_BYTE,
+			       worker, OPT_TASK_ARTIFACT_TAG, MPI_COMM_WORLD,
+			       &item->artifact_request);
+		if (rc != MPI_SUCCESS) {
+			log_fatal
+			    ("Sending build (%d) to worker %d was unsuccessful.  Received code: %d from MPI_Isend",
+			     seq, worker, rc);
+			MPI_Abort(MPI_COMM_WORLD, rc);
+		}
+	}
+
+	/* If the worker has a free slot it starts now; otherwise when it
+	 * finishes something it already has (see opt_task_start_waiting) */
+	if (in_flight[worker] < opt_task_worker_slots()) {
+		opt_task_start_item(item);
+	}
+	if (in_flight[worker] == 0) {
+		last_heard[worker] = MPI_Wtime();
+	}
+
+	/* Keep track of which particles this worker is working on, in order */
+	item->next = NULL;
+	if (working_on_item[worker] == NULL) {
+		working_on_item[worker] = item;
+	} else {
+		for (last = working_on_item[worker]; last->next != NULL;
+		     last = last->next) ;
+		last->next = item;
+	}
+	in_flight[worker]++;
+	worker_state[worker] = OPT_TASK_BUSY;
+
+	/* The worker answers each work item with exactly one fitness, and in
+	 * the order they were sent, so we only need one receive posted at a
+	 * time. */
+	if (result_request[worker] == MPI_REQUEST_NULL) {
+		opt_task_post_result_receive(worker);
+	}
+	/* Workers with several slots keep their benchmarks apart themselves */
+	if (config->exclusive_benchmark && opt_task_worker_slots() == 1
+	    && bench_request[worker] == MPI_REQUEST_NULL) {
+		opt_task_post_bench_receive(worker);
+	}
+	if (config->heartbeat_interval > 0
+	    && heartbeat_request[worker] == MPI_REQUEST_NULL) {
+		opt_task_post_heartbeat_receive(worker);
+	}
+	/* As do they their builds' results */
+	if (config->artifact_glob != NULL && opt_task_worker_slots() == 1
+	    && build_request[worker] == MPI_REQUEST_NULL) {
+		opt_task_post_build_receive(worker);
+	}
+
+	return rc;
+}
+
+/* An item has been evaluated; report it, and we are done with it */
+static void opt_task_finish_item(opt_work_item_t * item,
+				 const opt_task_result_t * result)
+{
+	/* Tell our listener, who should act accordingly (eg adding the next
+	 * position to our work queue, or telling us to stop work). */
+	log_trace("taskfarm.c: Updating particle %d with fitness %lf",
+		  item->uid, result->fitness);
+	if (!item->speculative) {
+		/* Their uids are not the swarm's, and run into the millions */
+		opt_task_record_cost(item->uid, item->elapsed);
+	}
+	update_fitness(item->uid, result->fitness, false);
+	/* After the fitness, so that the position it was measured at has been
+	 * stored to go with it */
+	if (result_listener != NULL) {
+		result_listener(item->uid, item->position, result);
+	}
+
+	/* Clean up now we're finished with this item. */
+	free(item->message);
+	free(item);
+}
+
+/*
+ * A worker has finished an item, so it has a slot free for the next one it
+ * was sent, if any.  Items are taken up in the order they were sent.
+ */
+static void opt_task_start_waiting(int worker)
+{
+	opt_work_item_t *item = NULL;
+	int running = 0;
+
+	for (item = working_on_item[worker]; item != NULL; item = item->next) {
+		if (item->started > 0.0) {
+			running++;
+		} else if (running < opt_task_worker_slots()) {
+			opt_task_start_item(item);
+			running++;
+		}
+	}
+}
+
+int opt_recv_fitness_from_worker(int worker)
+{
+	opt_work_item_t *item = NULL;
+	opt_work_item_t *prev = NULL;
+	/* A copy, as the buffer is reused by the next receive we post */
+	opt_task_result_t result = result_buffer[worker];
+	double fitness = result.fitness;
+	int seq = result.seq;
+	bool built;
+
+	log_debug("taskfarm.c: Received fitness %lf from worker %d (seq #%d)",
+		  fitness, worker, seq);
+	for (item = working_on_item[worker];
+	     item != NULL && item->message[OPT_HEADER_SEQ] != seq;
+	     item = item->next) {
+		prev = item;
+	}
+
+	if (item == NULL) {
+		/* Should never get here */
+		log_error
+		    ("Received fitness %lf from worker %d, but this worker doesn't appear to be working on it (seq #%d)!",
+		     fitness, worker, seq);
+		if (working_on_item[worker] == NULL) {
+			worker_state[worker] = OPT_TASK_WAITING;
+		} else {
+			opt_task_post_result_receive(worker);
+		}
+		return 1;
+	}
+
+	if (config->exclusive_benchmark) {
+		opt_task_release_benchmark(worker);
+	}
+
+	last_heard[worker] = MPI_Wtime();
+	item->elapsed += last_heard[worker] - item->started;
+	if (prev == NULL) {
+		working_on_item[worker] = item->next;
+	} else {
+		prev->next = item->next;
+	}
+	opt_task_start_waiting(worker);
+	in_flight[worker]--;
+	if (in_flight[worker] > 0) {
+		/* Already has more, and will report on that next */
+		opt_task_post_result_receive(worker);
+	} else {
+		worker_state[worker] = OPT_TASK_WAITING;
+	}
+
+	/* The worker must have had the item to report on it, so the sends will
+	 * have completed. */
+	MPI_Wait(&item->request, MPI_STATUS_IGNORE);
+	MPI_Wait(&item->artifact_request, MPI_STATUS_IGNORE);
+	free(item->artifact);
+	item->artifact = NULL;
+	item->artifact_size = 0;
+
+	if (result.build_hash == 0) {
+		/* Benchmarked what a builder hashed */
+		result.build_hash = item->build_hash;
+	}
+	built = opt_task_get_role(worker) == OPT_TASK_BUILDER
+	    && fitness < DBL_MAX && !result.reused;
+	opt_task_record_result(item, &result, built);
+
+	if (built) {
+		/* Built and tested successfully; queue it for a benchmarker */
+		if (config->staging_dir == NULL) {
+			opt_task_receive_artifact(worker, item);
+		}
+		item->message[OPT_HEADER_ARTIFACT] = item->message[OPT_HEADER_SEQ];
+		item->build_hash = result.build_hash;
+		log_trace("taskfarm.c: Queueing particle %d for benchmarking",
+			  item->uid);
+		opt_task_bench_queue_push(item);
+		return 0;
+	}
+
+	opt_task_finish_item(item, &result);
+
+	return 0;
+}
+
+/*
+ * Put an item that was sent to a lost worker back on the queue it came
+ * from.  The original cannot be reused or freed, since the send to the
+ * lost worker may never complete, so this is a copy.
+ */
+static void opt_task_requeue(opt_work_item_t * item)
+{
+	opt_work_item_t *copy = NULL;
+	int length = OPT_HEADER_LENGTH + item->message[OPT_HEADER_SIZE];
+
+	if (item->message[OPT_HEADER_TYPE] != OPT_TASK_BENCH_MSG) {
+		opt_queue_push_item(item->uid, item->position,
+				    item->speculative);
+		return;
+	}
+
+	copy = malloc(sizeof(*copy));
+	if (copy == NULL) {
+		log_fatal("Unable to allocate memory to requeue a build.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	*copy = *item;
+	copy->message = malloc(length * sizeof(*copy->message));
+	if (copy->message == NULL) {
+		log_fatal("Unable to allocate memory to requeue a build.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	memcpy(copy->message, item->message, length * sizeof(*copy->message));
+	copy->position = copy->message + OPT_HEADER_LENGTH;
+	copy->request = MPI_REQUEST_NULL;
+	copy->artifact_request = MPI_REQUEST_NULL;
+	if (item->artifact != NULL) {
+		copy->artifact = malloc(item->artifact_size);
+		if (copy->artifact == NULL) {
+			log_fatal("Unable to allocate memory to requeue a build.");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		memcpy(copy->artifact, item->artifact, item->artifact_size);
+	}
+	copy->started = 0.0;
+	copy->elapsed = 0.0;
+	copy->deadline = DBL_MAX;
+	opt_task_bench_queue_push(copy);
+}
+
+/*
+ * Stop using a worker that has hung or whose node has died, and hand
+ * everything it had on to others.  Whatever it sends from now on is
+ * ignored.  If that leaves nobody to do some part of the work, there is no
+ * point carrying on.
+ */
+static void opt_task_lose_worker(int worker, const char *reason)
+{
+	opt_work_item_t *item = NULL;
+	int i, size;
+	bool builders = false, benchmarkers = false;
+
+	log_error
+	    ("Worker %d %s.  Requeueing its %d item(s) and no longer using it.",
+	     worker, reason, in_flight[worker]);
+
+	if (result_request[worker] != MPI_REQUEST_NULL) {
+		MPI_Cancel(&result_request[worker]);
+		MPI_Wait(&result_request[worker], MPI_STATUS_IGNORE);
+	}
+	if (bench_request[worker] != MPI_REQUEST_NULL) {
+		MPI_Cancel(&bench_request[worker]);
+		MPI_Wait(&bench_request[worker], MPI_STATUS_IGNORE);
+	}
+	if (heartbeat_request[worker] != MPI_REQUEST_NULL) {
+		MPI_Cancel(&heartbeat_request[worker]);
+		MPI_Wait(&heartbeat_request[worker], MPI_STATUS_IGNORE);
+	}
+	if (build_request[worker] != MPI_REQUEST_NULL) {
+		MPI_Cancel(&build_request[worker]);
+		MPI_Wait(&build_request[worker], MPI_STATUS_IGNORE);
+	}
+	if (config->exclusive_benchmark) {
+		wants_benchmark[worker] = false;
+		opt_task_release_benchmark(worker);
+	}
+
+	for (item = working_on_item[worker]; item != NULL; item = item->next) {
+		opt_task_requeue(item);
+	}
+	working_on_item[worker] = NULL;
+	in_flight[worker] = 0;
+	worker_state[worker] = OPT_TASK_LOST;
+
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	for (i = 1; i < size; i++) {
+		if (worker_state[i] == OPT_TASK_LOST) {
+			continue;
+		}
+		if (opt_task_get_role(i) == OPT_TASK_BENCHMARKER) {
+			benchmarkers = true;
+		} else {
+			builders = true;
+		}
+	}
+	if (!builders || (config->benchmark_workers > 0 && !benchmarkers)) {
+		log_fatal("Too many workers have been lost to carry on.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+}
+
+/*
+ * At the end of the run, a lost worker may still be alive, if it was only
+ * slow, or the command it was stuck on has since been killed.  Unless it
+ * is told to stop like everyone else, it never reaches MPI_Finalize, and
+ * nor do we.  As we stopped listening to it, it may be blocked sending to
+ * us or waiting for an answer, so until it goes quiet, whatever it sends
+ * is taken and thrown away, and its questions answered as if nothing were
+ * known (see opt_task_drain_lost).
+ */
+static int lost_stop_message[OPT_HEADER_LENGTH] = { 0 };
+
+static void opt_task_stop_lost(int worker)
+{
+	MPI_Request request = MPI_REQUEST_NULL;
+	int rc;
+
+	log_debug("taskfarm.c: Telling lost worker %d to stop.", worker);
+	lost_stop_message[OPT_HEADER_TYPE] = OPT_TASK_STOP_MSG;
+	/* It may never take this, so we cannot wait for it */
+	rc = MPI_Isend(lost_stop_message, OPT_HEADER_LENGTH, MPI_INT, worker,
+		       OPT_TASK_MSG_TAG, MPI_COMM_WORLD, &request);
+	if (rc != MPI_SUCCESS) {
+		log_fatal
+		    ("Sending stop message to lost worker %d was unsuccessful.  Received code: %d from MPI_Isend",
+		     worker, rc);
+		MPI_Abort(MPI_COMM_WORLD, rc);
+	}
+	MPI_Request_free(&request);
+	worker_state[worker] = OPT_TASK_STOPPING;
+	last_heard[worker] = MPI_Wtime();
+}
+
+/*
+ * Take everything a lost worker that has been told to stop has sent us.
+ * Returns true once it has not been heard from for as long as it takes a
+ * busy worker to be given up on, after which it is assumed to have gone.
+ */
+static bool opt_task_drain_lost(int worker)
+{
+	MPI_Message message;
+	MPI_Status status;
+	opt_task_result_t reply;
+	uint64_t hash;
+	char *scratch = NULL;
+	int flag = 0, count, beat, grant = 0;
+	double silence = (double)OPT_TASK_MISSED_HEARTBEATS *
+	    config->heartbeat_interval;
+
+	for (;;) {
+		MPI_Improbe(worker, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &message,
+			    &status);
+		if (!flag) {
+			break;
+		}
+		last_heard[worker] = MPI_Wtime();
+		switch (status.MPI_TAG) {
+		case OPT_TASK_MSG_TAG:
+			MPI_Mrecv(&reply, 1, result_type, &message,
+				  MPI_STATUS_IGNORE);
+			break;
+		case OPT_TASK_HEARTBEAT_TAG:
+			MPI_Mrecv(&beat, 1, MPI_INT, &message, MPI_STATUS_IGNORE);
+			break;
+		case OPT_TASK_BENCH_REQUEST_TAG:
+			MPI_Mrecv(&grant, 1, MPI_INT, &message, MPI_STATUS_IGNORE);
+			/* Everyone else has stopped, so the node is free */
+			MPI_Send(&grant, 1, MPI_INT, worker,
+				 OPT_TASK_BENCH_GRANT_TAG, MPI_COMM_WORLD);
+			break;
+		case OPT_TASK_BUILD_QUERY_TAG:
+			MPI_Mrecv(&hash, 1, MPI_UINT64_T, &message,
+				  MPI_STATUS_IGNORE);
+			opt_task_clear_result(&reply);
+			MPI_Send(&reply, 1, result_type, worker,
+				 OPT_TASK_BUILD_REPLY_TAG, MPI_COMM_WORLD);
+			break;
+		default:
+			/* A build for a benchmarker */
+			MPI_Get_count(&status, MPI_BYTE, &count);
+			scratch = malloc(MAX(count, 1));
+			if (scratch == NULL) {
+				log_fatal("Unable to allocate memory to receive a build from lost worker %d",
+					  worker);
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+			MPI_Mrecv(scratch, count, MPI_BYTE, &message,
+				  MPI_STATUS_IGNORE);
+			free(scratch);
+		}
+	}
+	if (config->heartbeat_interval > 0
+	    && MPI_Wtime() - last_heard[worker] <= silence) {
+		return false;
+	}
+	log_debug("taskfarm.c: Lost worker %d has gone quiet; assuming it has stopped.",
+		  worker);
+	return true;
+}
+
+/* Give up on any busy worker that is past its deadline or has gone quiet */
+void opt_task_check_workers(void)
+{
+	int worker, size;
+	double now = MPI_Wtime();
+	double silence = (double)OPT_TASK_MISSED_HEARTBEATS *
+	    config->heartbeat_interval;
+	opt_work_item_t *item = NULL;
+
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	for (worker = 1; worker < size; worker++) {
+		if (worker_state[worker] != OPT_TASK_BUSY
+		    || working_on_item[worker] == NULL) {
+			continue;
+		}
+		/* Items yet to start have no deadline */
+		for (item = working_on_item[worker];
+		     item != NULL && now <= item->deadline; item = item->next) ;
+		if (item != NULL) {
+			opt_task_lose_worker(worker,
+					     "is past the deadline for its work");
+		} else if (config->heartbeat_interval > 0
+			   && now - last_heard[worker] > silence) {
+			opt_task_lose_worker(worker,
+					     "has stopped sending heartbeats");
+		}
+	}
+}
+
+/*
+ * Find a worker with fewer than max_items outstanding, or return 0 if there
+ * is none.  The worker is either a benchmarker, or one that builds,
+ * according to benchmark_pool.
+ */
+int opt_task_get_next_idle_worker(int max_items, bool benchmark_pool)
+{
+	int i;
+	int num_workers;
+	bool is_benchmarker;
+	MPI_Comm_size(MPI_COMM_WORLD, &num_workers);
+	/* Master does not do work itself */
+	num_workers--;
+	for (i = 1; i <= num_workers; i++) {
+		is_benchmarker = opt_task_get_role(i) == OPT_TASK_BENCHMARKER;
+		if (worker_state[i] != OPT_TASK_STOPPED
+		    && worker_state[i] != OPT_TASK_LOST
+		    && worker_state[i] != OPT_TASK_STOPPING
+		    && in_flight[i] < max_items
+		    && is_benchmarker == benchmark_pool) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Hand out as much of the queue as there are idle workers for, and then
+ * give workers that are busy their next item, so they can start on it as
+ * soon as they finish.  If we have been told to stop, idle workers are told
+ * to stop instead.
+ */
+void opt_task_dispatch(void)
+{
+	int worker, depth, num_idle, size;
+	int per_worker = opt_task_worker_slots();
+	opt_work_item_t *item = NULL;
+
+	/* Fill every worker's slots in turn, then prefetch.  Speculative work
+	 * only goes to a free slot. */
+	for (depth = 1; depth < per_worker + OPT_TASK_PREFETCH_DEPTH; depth++) {
+		while (!stop_work && queue_size > 0) {
+			worker = opt_task_get_next_idle_worker(depth, false);
+			if (worker == 0) {
+				break;
+			}
+			item = opt_task_take(&queue_front, &queue_back,
+					     &queue_size, depth <= per_worker);
+			if (item == NULL) {
+				break;
+			}
+			log_trace
+			    ("taskfarm.c: Sending next work item to worker %d (%d already outstanding)",
+			     worker, in_flight[worker]);
+			opt_task_send_to_worker(worker, OPT_TASK_WORK_MSG, item);
+		}
+		while (!stop_work && bench_queue_size > 0) {
+			worker = opt_task_get_next_idle_worker(depth, true);
+			if (worker == 0) {
+				break;
+			}
+			item = opt_task_bench_queue_pop(depth <= per_worker);
+			if (item == NULL) {
+				break;
+			}
+			log_trace
+			    ("taskfarm.c: Sending build to benchmarker %d (%d already outstanding)",
+			     worker, in_flight[worker]);
+			opt_task_send_to_worker(worker, OPT_TASK_BENCH_MSG, item);
+		}
+	}
+
+	if (stop_work) {
+		while ((worker = opt_task_get_next_idle_worker(1, false)) != 0
+		       || (worker = opt_task_get_next_idle_worker(1, true)) != 0) {
+			log_trace("taskfarm.c: Telling worker %d to stop.",
+				  worker);
+			opt_task_send_to_worker(worker, OPT_TASK_STOP_MSG, NULL);
+		}
+	} else if (idle_listener != NULL && queue_size == 0) {
+		/* Anything the listener queues wakes us to dispatch it */
+		num_idle = 0;
+		MPI_Comm_size(MPI_COMM_WORLD, &size);
+		for (worker = 1; worker < size; worker++) {
+			if (worker_state[worker] != OPT_TASK_STOPPED
+			    && worker_state[worker] != OPT_TASK_LOST
+			    && in_flight[worker] < per_worker
+			    && opt_task_get_role(worker) != OPT_TASK_BENCHMARKER) {
+				num_idle += per_worker - in_flight[worker];
+			}
+		}
+		if (num_idle > 0) {
+			idle_listener(num_idle);
+		}
+	}
+}
+
+/*
+ * Wait for at least one of the posted result receives to complete.  The
+ * indices of those that did are stored in completed, and their number
+ * returned.  This also returns (with 0) as soon as work is added to the
+ * queue or we are told to stop, so that nothing sits in the queue while a
+ * worker is idle.
+ *
+ * MPI_Waitany would do, except that most MPI implementations busy-poll
+ * inside it, and it cannot be interrupted by a change to the queue.
+ * Instead we test, and sleep between tests for an exponentially increasing
+ * period, bounded by OPT_TASK_MAX_WAIT_US.
+ */
+int opt_task_wait_for_results(int num_requests, int *completed)
+{
+	int count = 0;
+	long delay = 0;
+	double started = MPI_Wtime();
+	struct timespec pause;
+
+	/* Come back every so often, so that lost workers are noticed */
+	while (!wake_master && MPI_Wtime() - started < 1.0) {
+		MPI_Testsome(num_requests, result_request, &count, completed,
+			     MPI_STATUSES_IGNORE);
+		if (count != MPI_UNDEFINED && count > 0) {
+			return count;
+		}
+		delay = MIN(OPT_TASK_MAX_WAIT_US,
+			    MAX(OPT_TASK_MIN_WAIT_US, delay * 2));
+		pause.tv_sec = 0;
+		pause.tv_nsec = delay * 1000;
+		nanosleep(&pause, NULL);
+	}
+	return 0;
+}
+
+void master(void)
+{
+	int i, count;
+	int num_workers, worker;
+	int my_rank, size;
+	int *completed = NULL;
+	int num_requests;
+	bool all_finished = false;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	log_trace("taskfarm.c: Entered master function.");
+
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	/* Master does not do work itself */
+	num_workers = size - 1;
+	/*
+	 * This check should be superfluous, and we ought to error if it fails.
+	 */
+	if (MASTER == my_rank) {
+		/* Results, then requests to benchmark, heartbeats and build
+		 * queries (if enabled) */
+		num_requests = 4 * size;
+		completed = malloc(num_requests * sizeof(*completed));
+		stop_work = false;
+		log_debug("taskfarm.c: Sending work items to %d workers",
+			  num_workers);
+
+		/*
+		 * General work loop.  Everything is driven by the arrival of
+		 * results from workers, with each result (usually) causing
+		 * the listener to add the next position to the queue.
+		 */
+		while (!all_finished) {
+			wake_master = 0;
+			opt_task_dispatch();
+
+			if (stop_work) {
+				/* Workers that never come back to us are given up
+				 * on by opt_task_check_workers, rather than waited
+				 * for forever, and then told to stop as well. */
+				all_finished = true;
+				for (worker = 1; worker <= num_workers;
+				     worker++) {
+					if (worker_state[worker] == OPT_TASK_LOST) {
+						opt_task_stop_lost(worker);
+					}
+					if (worker_state[worker] == OPT_TASK_STOPPING
+					    && opt_task_drain_lost(worker)) {
+						worker_state[worker] = OPT_TASK_STOPPED;
+					}
+					if (worker_state[worker] != OPT_TASK_STOPPED) {
+						all_finished = false;
+						log_trace
+						    ("taskfarm.c: worker %d is still not stopped",
+						     worker);
+					}
+				}
+				if (all_finished) {
+					log_trace
+					    ("taskfarm.c: All workers are idle and we have been told to stop.  Stopping.");
+					break;
+				}
+				log_trace
+				    ("taskfarm.c: Should be stopping, but have not heard from all workers yet.");
+			}
+
+			count = opt_task_wait_for_results(num_requests, completed);
+			for (i = 0; i < count; i++) {
+				if (completed[i] < size) {
+					opt_recv_fitness_from_worker(completed[i]);
+				} else if (completed[i] < 2 * size) {
+					opt_task_request_benchmark(completed[i] - size);
+				} else if (completed[i] < 3 * size) {
+					opt_task_heartbeat_from(completed[i] - 2 * size);
+				} else {
+					opt_task_build_query_from(completed[i] - 3 * size);
+				}
+			}
+			opt_task_check_workers();
+		}
+
+		free(completed);
+		opt_task_clean_up();
+	} else {
+		log_error
+		    ("Not the master process, yet the master() function was called.");
+	}
+}
+
+/* A file of the current build's entry in a build cache; free the result */
+static char *opt_task_cache_path(const char *dir, const char *suffix)
+{
+	char *path = NULL;
+
+	path = malloc(strlen(dir) + strlen(cache_key) + strlen(suffix) + 2);
+	sprintf(path, "%s/%s%s", dir, cache_key, suffix);
+	return path;
+}
+
+/*
+ * Whether the build cache in dir has the current build.  The canonical
+ * flags are kept beside each archive, in case two builds ever have the
+ * same key.
+ */
+static bool opt_task_cache_holds(const char *dir)
+{
+	const char *flags = cache_flags;
+	size_t length = strlen(flags);
+	char *stored = NULL;
+	char *path = NULL;
+	bool found = false;
+	FILE *file = NULL;
+
+	path = opt_task_cache_path(dir, ".flags");
+	file = fopen(path, "r");
+	free(path);
+	if (file == NULL) {
+		return false;
+	}
+	stored = malloc(length + 1);
+	if (stored != NULL) {
+		found = fread(stored, 1, length + 1, file) == length
+		    && memcmp(stored, flags, length) == 0;
+		free(stored);
+	}
+	fclose(file);
+
+	if (found) {
+		path = opt_task_cache_path(dir, ".tar");
+		found = file_exists(path);
+		free(path);
+	}
+	return found;
+}
+
+/* A new, empty file in dir, to be renamed into place; free the result */
+static char *opt_task_cache_temp(const char *dir)
+{
+	const char *format = "%s/.optsearch-XXXXXX";
+	char *path = NULL;
+	int fd;
+
+	path = malloc(strlen(dir) + strlen(format) + 1);
+	sprintf(path, format, dir);
+	fd = mkstemp(path);
+	if (fd < 0) {
+		log_error("Unable to create a file in the build cache %s: %s",
+			  dir, strerror(errno));
+		free(path);
+		return NULL;
+	}
+	close(fd);
+	return path;
+}
+
+/*
+ * Add the current build to the build cache in dir: a copy of the archive
+ * at from, or if that is NULL, a new archive of config->artifact_dir.  The
+ * files are written under temporary names and renamed into place, the
+ * flags last, so that nobody sees an entry before it is complete.
+ */
+static int opt_task_cache_put(const char *dir, const char *from)
+{
+	char *mkdir_command[] = { "mkdir", "-p", NULL, NULL };
+	char *tar_command[] = { "tar", "-cf", NULL, "-C", NULL, ".", NULL };
+	char *copy_command[] = { "cp", NULL, NULL, NULL };
+	const char *flags = cache_flags;
+	char *temp = NULL;
+	char *path = NULL;
+	double time = 0.0;
+	int retval;
+	FILE *file = NULL;
+
+	if (opt_task_cache_holds(dir)) {
+		/* Somebody else got there first */
+		return 0;
+	}
+	mkdir_command[2] = (char *)dir;
+	retval = run_command_argv(mkdir_command, NULL, &time, config->timeout);
+	if (retval == 0) {
+		temp = opt_task_cache_temp(dir);
+		retval = temp == NULL;
+	}
+	if (retval == 0) {
+		if (from == NULL) {
+			tar_command[2] = temp;
+			tar_command[4] = config->artifact_dir;
+			log_debug("taskfarm.c: Archiving %s into the build cache %s.",
+				  config->artifact_dir, dir);
+			retval = run_command_argv(tar_command, NULL, &time,
+						  config->timeout);
+		} else {
+			copy_command[1] = (char *)from;
+			copy_command[2] = temp;
+			log_debug("taskfarm.c: Copying %s into the build cache %s.",
+				  from, dir);
+			retval = run_command_argv(copy_command, NULL, &time,
+						  config->timeout);
+		}
+	}
+	if (retval == 0) {
+		path = opt_task_cache_path(dir, ".tar");
+		retval = rename(temp, path);
+		free(path);
+	}
+
+	if (retval == 0) {
+		if (temp != NULL) {
+			free(temp);
+		}
+		temp = opt_task_cache_temp(dir);
+		file = temp == NULL ? NULL : fopen(temp, "w");
+		if (file == NULL || fputs(flags, file) == EOF) {
+			retval = 1;
+		}
+		if (file != NULL && fclose(file) != 0) {
+			retval = 1;
+		}
+		if (retval == 0) {
+			path = opt_task_cache_path(dir, ".flags");
+			retval = rename(temp, path);
+			free(path);
+		}
+	}
+	if (temp != NULL) {
+		if (retval != 0) {
+			unlink(temp);
+		}
+		free(temp);
+	}
+	if (retval != 0) {
+		log_warn("Unable to add build %s to the build cache %s",
+			 cache_key, dir);
+	}
+	return retval;
+}
+
+/*
+ * Unpack the current build from the node's build cache, or else from the
+ * shared one, adding it to the node's on the way, into config->artifact_dir.
+ * As the clean script is not run, anything else already there is left.
+ * Returns 0 if there was a build to use.
+ */
+static int opt_task_cache_fetch(void)
+{
+	char *rm_command[] = { "rm", "-rf", NULL, NULL };
+	char *mkdir_command[] = { "mkdir", "-p", NULL, NULL };
+	char *tar_command[] = { "tar", "-xf", NULL, "-C", NULL, NULL };
+	const char *dir = NULL;
+	char *path = NULL;
+	double time = 0.0;
+	int retval;
+
+	if (config->build_cache != NULL
+	    && opt_task_cache_holds(config->build_cache)) {
+		dir = config->build_cache;
+	} else if (config->shared_build_cache != NULL
+		   && opt_task_cache_holds(config->shared_build_cache)) {
+		dir = config->shared_build_cache;
+		if (config->build_cache != NULL) {
+			path = opt_task_cache_path(dir, ".tar");
+			if (opt_task_cache_put(config->build_cache, path) == 0) {
+				dir = config->build_cache;
+			}
+			free(path);
+		}
+	}
+	if (dir == NULL) {
+		return 1;
+	}
+
+	path = opt_task_cache_path(dir, ".tar");
+	rm_command[2] = config->artifact_dir;
+	mkdir_command[2] = config->artifact_dir;
+	tar_command[2] = path;
+	tar_command[4] = config->artifact_dir;
+	log_debug("taskfarm.c: Unpacking %s into %s.", path,
+		  config->artifact_dir);
+	/*
+	 * The clean script is skipped on a hit, so empty artifact-dir first or
+	 * whatever the last candidate built would be mixed in with the archive.
+	 */
+	retval = run_command_argv(rm_command, NULL, &time, config->timeout);
+	if (retval == 0) {
+		retval = run_command_argv(mkdir_command, NULL, &time,
+					  config->timeout);
+	}
+	if (retval == 0) {
+		retval = run_command_argv(tar_command, NULL, &time,
+					  config->timeout);
+	}
+	if (retval != 0) {
+		log_warn("Unable to unpack the cached build %s, so building it again",
+			 path);
+	}
+	free(path);
+	return retval;
+}
+
+/* Add what has just been built to the build caches */
+static void opt_task_cache_store(void)
+{
+	char *path = NULL;
+
+	if (config->build_cache != NULL
+	    && opt_task_cache_put(config->build_cache, NULL) == 0) {
+		/* Copy that, rather than archiving it all over again */
+		path = opt_task_cache_path(config->build_cache, ".tar");
+	}
+	if (config->shared_build_cache != NULL) {
+		opt_task_cache_put(config->shared_build_cache, path);
+	}
+	free(path);
+}
+
+/*
+ * Clean, build and test, noting each stage in result.  The build is given
+ * build_timeout seconds, and the others config->timeout.  A build found in
+ * the build cache is unpacked instead of cleaning and building, and one
+ * that is not is added to it.  A build the same as one already tested and
+ * benchmarked is not tested, and is given its result, with result->reused
+ * set; there is then nothing more to do.
+ * opt_task_prepare_evaluation must have been called for the flags first.
+ */
+int prologue(opt_task_result_t * result, int build_timeout)
+{
+	int retval = 1;
+
+	if (!stop_work) {
+		if (use_build_cache && opt_task_cache_fetch() == 0) {
+			log_debug("taskfarm.c: Using cached build %s.",
+				  cache_key);
+			result->cached = 1;
+			result->stage = BUILD_POS;
+			result->status = 0;
+			retval = 0;
+		} else {
+			log_debug("taskfarm.c: Cleaning with %s.",
+				  config->clean_script);
+			retval = opt_task_run_stage(CLEAN_POS, result,
+						    config->timeout);
+			if (retval == 0) {
+				log_debug("taskfarm.c: Building with %s (timeout %ds).",
+					  config->build_script, build_timeout);
+				retval = opt_task_run_stage(BUILD_POS, result,
+							    build_timeout);
+			}
+			if (retval == 0 && use_build_cache) {
+				opt_task_cache_store();
+			}
+		}
+		if (retval == 0 && config->artifact_glob != NULL
+		    && opt_task_reuse_build(result)) {
+			return 0;
+		}
+		if (retval == 0) {
+			log_debug("taskfarm.c: Testing with %s.",
+				  config->accuracy_test);
+			retval = opt_task_run_stage(TEST_POS, result,
+						    config->timeout);
+		}
+	}
+
+	return retval;
+}
+
+/*
+ * Racing (config->racing): a candidate needs at least this many runs of the
+ * benchmark before it can be judged against the incumbent.
+ */
+#define OPT_TASK_RACE_MIN_REPEATS 3
+
+/*
+ * Whether a candidate whose n runs so far have this mean fitness and
+ * standard deviation is worse than the incumbent with config->race_confidence,
+ * by Welch's t-test.  An incumbent with a single run is taken as exact.
+ */
+static bool opt_task_race_lost(double mean, double stddev, int n,
+			       const opt_task_incumbent_t * incumbent)
+{
+	double var = stddev * stddev / n;
+	double inc_var = 0.0;
+	double se, dof;
+
+	if (incumbent->repeats < 1.0 || incumbent->mean == DBL_MAX) {
+		return false;
+	}
+	if (incumbent->repeats > 1.0) {
+		inc_var = incumbent->stddev * incumbent->stddev /
+		    incumbent->repeats;
+	}
+	se = sqrt(var + inc_var);
+	if (se <= 0.0) {
+		return mean > incumbent->mean;
+	}
+	/* Welch-Satterthwaite */
+	dof = (var + inc_var) * (var + inc_var) / (var * var / (n - 1) +
+						  (incumbent->repeats > 1.0 ?
+						   inc_var * inc_var /
+						   (incumbent->repeats - 1.0) :
+						   0.0));
+	return mean - incumbent->mean >
+	    t_quantile(config->race_confidence, dof) * se;
+}
+
+/*
+ * Whether the confidence interval of the mean of n runs is within
+ * config->epsilon percent of it, so that more runs would tell us little.
+ */
+static bool opt_task_race_settled(double mean, double stddev, int n)
+{
+	double half_width = t_quantile(1.0 - (1.0 - config->race_confidence) / 2.0,
+				       n - 1) * stddev / sqrt(n);
+
+	return half_width <= fabs(mean) * config->epsilon / 100.0;
+}
+
+/*
+ * With config->aggregate set to trimmed-mean, the fraction of runs dropped
+ * from each end, and with mad, how many scaled MADs from the median a run
+ * may be before it is rejected as an outlier.
+ */
+#define OPT_TASK_TRIM_FRACTION 0.2
+#define OPT_TASK_MAD_THRESHOLD 3.0
+
+/*
+ * Combines the n runs of the benchmark into one fitness, as config->aggregate
+ * says, before any negation for config->maximise.  May reorder values.
+ */
+static double opt_task_aggregate(int n, double * values,
+				 const opt_running_stats_t * stats)
+{
+	double fitness;
+	int kept = n;
+
+	switch (config->aggregate) {
+	case OPT_AGGREGATE_MEDIAN:
+		return median(n, values);
+	case OPT_AGGREGATE_MIN:
+		return config->maximise ? stats->max : stats->min;
+	case OPT_AGGREGATE_TRIMMED_MEAN:
+		return trimmed_mean(n, values, OPT_TASK_TRIM_FRACTION);
+	case OPT_AGGREGATE_MAD:
+		fitness = mad_filtered_mean(n, values, OPT_TASK_MAD_THRESHOLD,
+					    &kept);
+		if (kept < n) {
+			log_debug("taskfarm.c: Rejected %d of %d runs as outliers.",
+				  n - kept, n);
+		}
+		return fitness;
+	default:
+		return stats->mean;
+	}
+}
+
+/*
+ * Waits up to config->quiet_wait seconds for the node to be no more than
+ * config->quiet_threshold percent busy, eg with the build in another slot
+ * or the tail of our own, and leaves the last sample in noise.  If it never
+ * quietens, the benchmark is run anyway, and the noise reported with it.
+ */
+static void opt_task_wait_for_quiet(opt_node_noise_t * noise)
+{
+	double start = opt_monotonic_time();
+
+	if (config->quiet_threshold <= 0.0) {
+		sample_node_noise(noise, OPT_TASK_NOISE_INTERVAL);
+		return;
+	}
+	for (;;) {
+		sample_node_noise(noise, OPT_TASK_QUIET_INTERVAL);
+		if (noise->busy <= config->quiet_threshold) {
+			/* Including not knowing */
+			break;
+		}
+		if (stop_work
+		    || opt_monotonic_time() - start >= config->quiet_wait) {
+			log_warn("taskfarm.c: Node still %.0f%% busy (load %.2f) after %ds; benchmarking anyway.",
+				 noise->busy, noise->load, config->quiet_wait);
+			break;
+		}
+	}
+	log_debug("taskfarm.c: Node %.0f%% busy, load %.2f, at %.0fMHz.",
+		  noise->busy, noise->load, noise->freq);
+}
+
+/*
+ * Each run of the benchmark is given timeout seconds.  Fills in the
+ * fitness, which is config->fitness_metric, or what the benchmark printed,
+ * combined over the runs by config->aggregate (and negated with
+ * config->maximise), and the mean elapsed time, which is what the timeouts
+ * are based on whatever the metric, along with the standard deviation,
+ * each run's measurement and the noise on the node beforehand.  With
+ * config->racing, the runs stop early once the candidate is clearly worse
+ * than the incumbent, or its mean is known well enough.
+ */
+int benchmark(const opt_task_incumbent_t * incumbent,
+	      opt_task_result_t * result, int timeout)
+{
+	int retval = 1;
+	int i, n = 0;
+	double stdev = 0.0;
+	double perc = 0.0;
+	double fitness = DBL_MAX;
+	opt_command_usage_t usage;
+	opt_running_stats_t stats;
+	opt_running_stats_t elapsed;
+	opt_node_noise_t noise;
+	double * values = NULL;
+	char * output = NULL;
+	bool read_output = config->fitness_key != NULL
+	    || config->fitness_pattern != NULL;
+	if (config->benchmark_repeats == 0) {
+		/* Assume that if nothing was set in the config, the user intended to
+		 * run the test once. */
+		config->benchmark_repeats = 1;
+	}
+	values = calloc(sizeof(*values), config->benchmark_repeats);
+	running_stats_init(&stats);
+	running_stats_init(&elapsed);
+
+	if (!stop_work) {
+		opt_task_wait_for_quiet(&noise);
+		result->load = noise.load;
+		result->busy = noise.busy;
+		result->freq = noise.freq;
+		log_debug("taskfarm.c: Benchmarking with %s (timeout %ds).",
+			  config->perf_test, timeout);
+		retval = 0;
+		for (i = 0; retval == 0 && i < config->benchmark_warmup; i++) {
+			/* To fill the page cache, and get the CPUs up to speed */
+			retval = run_command_capture(stage_command[BENCH_POS].args,
+						     eval_env, &usage, NULL,
+						     timeout);
+			opt_task_record_stage(result, BENCH_POS, &usage);
+		}
+		if (retval) {
+			log_error("Error encountered attempting to warm up the benchmark.");
+		}
+		set_command_counters(config->fitness_metric >= OPT_METRIC_CYCLES);
+
+		for (i=0; retval == 0 && i < config->benchmark_repeats; i++) {
+			/*
+			 * This one MUST be repeated either config->benchmark_repeat
+			 * times, OR if 5 runs have a standard deviation <= config->epsilon,
+			 * then we should report the mean time, not the time of just one run.
+			 */
+			retval = run_command_capture(stage_command[BENCH_POS].args,
+						     eval_env, &usage,
+						     read_output ? &output : NULL,
+						     timeout);
+			opt_task_record_stage(result, BENCH_POS, &usage);
+			if (retval == 0 && read_output) {
+				retval = opt_task_read_fitness(output, &values[i]);
+			}
+			free(output);
+			output = NULL;
+			if (retval) {
+				log_error("Error encountered attempting to run the benchmark.");
+				break;
+			}
+			if (!read_output) {
+				values[i] = opt_task_fitness_of(&usage);
+			}
+			running_stats_push(&stats, values[i]);
+			running_stats_push(&elapsed, usage.wall_time);
+			n = i + 1;
+			if (n <= OPT_RESULT_MAX_SAMPLES) {
+				/* Before anything reorders values */
+				result->samples[i] = values[i];
+				result->num_samples = n;
+			}
+			stdev = running_stats_stddev(&stats);
+			if (config->racing) {
+				if (n < OPT_TASK_RACE_MIN_REPEATS) {
+					continue;
+				}
+				fitness = config->maximise ? -stats.mean : stats.mean;
+				if (opt_task_race_lost(fitness, stdev, n, incumbent)) {
+					log_debug("taskfarm.c: Worse than the incumbent (%e) after %d runs, with mean %e.",
+						  incumbent->mean, n, fitness);
+					break;
+				}
+				if (opt_task_race_settled(fitness, stdev, n)) {
+					log_debug("taskfarm.c: Mean settled at %e after %d runs.",
+						  fitness, n);
+					break;
+				}
+				continue;
+			}
+			if (config->aggregate != OPT_AGGREGATE_MEAN) {
+				/* Outliers are dealt with at the end, so only stop
+				 * early once the bulk of the runs agree */
+				if (n > 4 && scaled_mad(n, values) <=
+				    fabs(median(n, values)) * config->epsilon / 100.0) {
+					log_debug("taskfarm.c: Runs agreed to within expected error after %d runs.",
+						  n);
+					break;
+				}
+				continue;
+			}
+			perc = config->epsilon / 100.0 * stats.sum;
+			log_debug("converted %e percent to %e", config->epsilon, perc);
+			if (stdev > perc) {
+				/* Then all is NOT well */
+				log_error("Error (%e) outside of permitted range (%e)%.", stdev, config->epsilon);
+				result->noisy = 1;
+				break;
+			}
+			if (n > 4) {
+				/* We don't need to keep going */
+				log_debug("In 5 runs of the benchmark, deviation has stayed at or below expected error.");
+				break;
+			}
+		}
+		set_command_counters(false);
+		if (retval == 0 && n > 0) {
+			fitness = opt_task_aggregate(n, values, &stats);
+			result->stddev = stdev;
+			result->mean = config->maximise ? -stats.mean : stats.mean;
+			result->repeats = n;
+			result->bench_time = elapsed.sum / elapsed.n;
+			if (config->maximise) {
+				/* The search minimises */
+				fitness = -fitness;
+			}
+			if (result->noisy) {
+				/* The mean of runs this far apart means nothing */
+				fitness = DBL_MAX;
+			}
+		}
+	}
+	result->fitness = retval == 0 ? fitness : DBL_MAX;
+	free(values);
+
+	return retval;
+}
+
+/*
+ * Where a build is staged, named after the seq of the message that asked
+ * for it, which is unique for the run.  The caller must free the result.
+ */
+static char *opt_task_staged_artifact(int build_seq)
+{
+	const char *format = "%s/optsearch-%d.tar";
+	char *path = NULL;
+
+	path = malloc(strlen(config->staging_dir) + strlen(format) +
+		      CHAR_INT_MAX + 1);
+	sprintf(path, format, config->staging_dir, build_seq);
+	return path;
+}
+
+/*
+ * Somewhere to put an archive that only this process needs.  The caller
+ * must unlink and free it.
+ */
+static char *opt_task_temp_artifact(void)
+{
+	char *path = strdup("/tmp/optsearch-XXXXXX");
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		log_error("Unable to create temporary file for build: %s",
+			  strerror(errno));
+		free(path);
+		return NULL;
+	}
+	close(fd);
+	return path;
+}
+
+/*
+ * Builder: archive config->artifact_dir, either into the staging directory
+ * or into item->artifact, to be sent over MPI.
+ */
+int opt_task_pack_artifact(opt_work_item_t * item)
+{
+	char *command[] = { "tar", "-cf", NULL, "-C", NULL, ".", NULL };
+	char *path = NULL;
+	double time = 0.0;
+	int retval;
+	FILE *file = NULL;
+
+	if (config->staging_dir != NULL) {
+		path = opt_task_staged_artifact(item->message[OPT_HEADER_SEQ]);
+	} else {
+		path = opt_task_temp_artifact();
+	}
+	if (path == NULL) {
+		return 1;
+	}
+
+	command[2] = path;
+	command[4] = config->artifact_dir;
+	log_debug("taskfarm.c: Archiving %s into %s.", config->artifact_dir,
+		  path);
+	retval = run_command_argv(command, NULL, &time, config->timeout);
+
+	if (retval == 0 && config->staging_dir == NULL) {
+		file = fopen(path, "rb");
+		if (file == NULL) {
+			retval = 1;
+		} else {
+			fseek(file, 0, SEEK_END);
+			item->artifact_size = ftell(file);
+			rewind(file);
+			item->artifact =
+			    realloc(item->artifact, item->artifact_size + 1);
+			if (item->artifact == NULL
+			    || fread(item->artifact, 1, item->artifact_size,
+				     file) != (size_t) item->artifact_size) {
+				log_error("Unable to read back archived build");
+				retval = 1;
+			}
+			fclose(file);
+		}
+	}
+	if (config->staging_dir == NULL) {
+		unlink(path);
+	}
+	free(path);
+	return retval;
+}
+
+/*
+ * Benchmarker: clean, then unpack the build we were given into
+ * config->artifact_dir, ready to run the benchmark.
+ */
+int opt_task_unpack_artifact(opt_work_item_t * item,
+			     opt_task_result_t * result)
+{
+	char *mkdir_command[] = { "mkdir", "-p", NULL, NULL };
+	char *tar_command[] = { "tar", "-xf", NULL, "-C", NULL, NULL };
+	char *path = NULL;
+	double time = 0.0;
+	int retval;
+	FILE *file = NULL;
+
+	log_debug("taskfarm.c: Cleaning with %s.", config->clean_script);
+	retval = opt_task_run_stage(CLEAN_POS, result, config->timeout);
+	if (retval != 0) {
+		return retval;
+	}
+
+	if (config->staging_dir != NULL) {
+		path = opt_task_staged_artifact(item->message[OPT_HEADER_ARTIFACT]);
+	} else {
+		path = opt_task_temp_artifact();
+		if (path == NULL) {
+			return 1;
+		}
+		file = fopen(path, "wb");
+		if (file == NULL
+		    || fwrite(item->artifact, 1, item->artifact_size,
+			      file) != (size_t) item->artifact_size) {
+			log_error("Unable to write out build to %s", path);
+			retval = 1;
+		}
+		if (file != NULL) {
+			fclose(file);
 		}
 	}
-	return 0;
+
+	if (retval == 0) {
+		mkdir_command[2] = config->artifact_dir;
+		tar_command[2] = path;
+		tar_command[4] = config->artifact_dir;
+		log_debug("taskfarm.c: Unpacking %s into %s.", path,
+			  config->artifact_dir);
+		retval = run_command_argv(mkdir_command, NULL, &time,
+					  config->timeout);
+		if (retval == 0) {
+			retval = run_command_argv(tar_command, NULL, &time,
+						  config->timeout);
+		}
+	}
+	/* Either way, nobody else needs it now */
+	unlink(path);
+	free(path);
+	return retval;
 }
 
-void master(void)
+/* Set OPTSEARCH_SLOT for the scripts, so that they can keep apart */
+static void opt_task_set_slot_env(int slot)
 {
-	int flag = 0;
-	int num_workers, worker;
-	int my_rank;
-	opt_work_item_t *item = NULL;
-	double fitness;
-	bool all_finished = false;
+	char value[CHAR_INT_MAX + 1];
 
-	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
-	log_trace("taskfarm.c: Entered master function.");
+	snprintf(value, sizeof(value), "%d", slot);
+	setenv("OPTSEARCH_SLOT", value, 1);
+}
 
-	MPI_Comm_size(MPI_COMM_WORLD, &num_workers);
-	worker_state = malloc(sizeof(*worker_state) * num_workers);
-	/* Master does not do work itself */
-	num_workers--;
-	/*
-	 * This check should be superfluous, and we ought to error if it fails.
-	 */
-	if (MASTER == my_rank) {
-		stop_work = false;
-		/* Initialise workers with work from queue */
-		log_debug("taskfarm.c: Sending work items to %d workers",
-			  num_workers);
-		worker = 1;	/* Don't want root to send to itself */
-		item = opt_queue_pop();
-		while (item != NULL && worker <= num_workers) {
-			/* I hope all the commands are null-terminated */
-			opt_task_send_to_worker(worker, OPT_TASK_WORK_MSG,
-						item);
-			item = opt_queue_pop();
-			worker++;
+/*
+ * Read a NUMA node's CPUs from sysfs, which lists them as ranges, eg
+ * "0-3,8-11", and mark them as belonging to that node.
+ */
+static void opt_task_read_node_cpus(int node, int *node_of_cpu)
+{
+	char path[64];
+	int first, last, cpu;
+	FILE *cpulist = NULL;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	cpulist = fopen(path, "r");
+	if (cpulist == NULL) {
+		return;
+	}
+	while (fscanf(cpulist, "%d", &first) == 1) {
+		last = first;
+		if (fscanf(cpulist, "-%d", &last) != 1) {
+			last = first;
 		}
-		log_trace
-		    ("taskfarm.c: Finished sending first batch of work items to workers");
+		for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+			node_of_cpu[cpu] = node;
+		}
+		if (fgetc(cpulist) != ',') {
+			break;
+		}
+	}
+	fclose(cpulist);
+}
 
-		/*
-		 * General work loop.  I could not think of a good way to do this
-		 * without using an MPI_Probe of some variety
-		 */
-		worker = 0;
-		while (!all_finished) {
-			/* This trace message is too noisy */
-			//log_trace("taskfarm.c: probing for a message from workers (MPI_ANY_TAG)");
-			MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD,
-				   &flag, MPI_STATUS_IGNORE);
-			if (flag) {
-				opt_recv_fitness_from_worker(&worker, &fitness);
-				log_debug
-				    ("taskfarm.c: Received fitness score %lf from rank %d",
-				     fitness, worker);
-			} else {
-				log_trace
-				    ("taskfarm.c: No workers are trying to send to master.");
-				/* Deal with workers left idle when queue was empty (if that
-				 * happened), if queue is now not empty */
-				worker = opt_task_get_next_idle_worker();
-				if (worker != 0) {
-					log_trace
-					    ("taskfarm.c: Found idle worker %d",
-					     worker);
-				} else {
-					log_trace
-					    ("taskfarm.c: No idle workers; sleeping");
-					sleep(10);
-				}
+/*
+ * With config->pin_slots, share out the CPUs we may run on between the
+ * slots, in contiguous blocks, so that each slot's commands have cores of
+ * their own.  With config->slot_numa the CPUs are ordered by NUMA node
+ * first, so that blocks do not straddle nodes where that can be helped,
+ * and each slot's memory is bound to the node of its first CPU.
+ */
+static void opt_task_plan_slots(void)
+{
+	cpu_set_t available;
+	int cpus[CPU_SETSIZE];
+	int node_of_cpu[CPU_SETSIZE];
+	int num_cpus = 0;
+	int cpu, node, slot, i, first, count, tmp;
+
+	if (!config->pin_slots) {
+		return;
+	}
+	if (sched_getaffinity(0, sizeof(available), &available) < 0) {
+		log_warn("Unable to get CPU affinity, so not pinning slots: %s",
+			 strerror(errno));
+		return;
+	}
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		node_of_cpu[cpu] = 0;
+		if (CPU_ISSET(cpu, &available)) {
+			cpus[num_cpus++] = cpu;
+		}
+	}
+	if (config->slot_numa) {
+		for (node = 0; node < CPU_SETSIZE; node++) {
+			opt_task_read_node_cpus(node, node_of_cpu);
+		}
+		/* Insertion sort by node; stable, so CPUs stay in order */
+		for (i = 1; i < num_cpus; i++) {
+			tmp = cpus[i];
+			for (cpu = i; cpu > 0
+			     && node_of_cpu[cpus[cpu - 1]] > node_of_cpu[tmp];
+			     cpu--) {
+				cpus[cpu] = cpus[cpu - 1];
 			}
+			cpus[cpu] = tmp;
+		}
+	}
+	if (num_slots > num_cpus) {
+		log_warn("%d slots but only %d CPUs, so some slots will share",
+			 num_slots, num_cpus);
+	}
 
-			if (stop_work) {
-				if (worker != 0) {
-					log_trace
-					    ("taskfarm.c: Telling worker %d to stop.",
-					     worker);
-					opt_task_send_to_worker(worker,
-								OPT_TASK_STOP_MSG,
-								NULL);
-				}
-				/* This could be a problem if a particular worker never comes
-				 * back to us.  Hopefully being sent the quit_signal as
-				 * defined in the config will mean this doesn't matter */
-				all_finished = true;
-				for (worker = 1; worker <= num_workers;
-				     worker++) {
-					if (worker_state[worker] !=
-					    OPT_TASK_STOPPED) {
-						all_finished = false;
-						log_trace
-						    ("taskfarm.c: worker %d is still not stopped",
-						     worker);
-					}
-				}
-				if (all_finished) {
-					log_trace
-					    ("taskfarm.c: All workers are idle and we have been told to stop.  Stopping.");
-					break;
-				} else {
-					log_trace
-					    ("taskfarm.c: Should be stopping, but have not heard from all workers yet.");
-					continue;
-				}
-			} else if (item != NULL && worker != 0) {
-				log_trace
-				    ("taskfarm.c: Sending next work item to worker %d",
-				     worker);
-				opt_task_send_to_worker(worker,
-							OPT_TASK_WORK_MSG,
-							item);
-				item = opt_queue_pop();
-			} else if (item == NULL) {
-				if (worker != 0) {
-					worker_state[worker] = OPT_TASK_WAITING;
-					log_trace
-					    ("taskfarm.c: Worker %d is starving",
-					     worker);
-				}
-				/* Sleep briefly, then see if there is anything in the queue yet */
-				log_trace
-				    ("taskfarm.c: Queue is empty, sleeping before checking it again.");
-				sleep(10);
-				item = opt_queue_pop();
+	slot_cpus = malloc(num_slots * sizeof(*slot_cpus));
+	slot_node = malloc(num_slots * sizeof(*slot_node));
+	if (slot_cpus == NULL || slot_node == NULL) {
+		log_fatal("Unable to allocate memory for slot CPU sets.");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (slot = 0; slot < num_slots; slot++) {
+		CPU_ZERO(&slot_cpus[slot]);
+		if (num_slots > num_cpus) {
+			first = slot % num_cpus;
+			count = 1;
+		} else {
+			/* The first num_cpus % num_slots slots get one extra */
+			count = num_cpus / num_slots;
+			first = slot * count + MIN(slot, num_cpus % num_slots);
+			if (slot < num_cpus % num_slots) {
+				count++;
 			}
 		}
+		for (i = first; i < first + count; i++) {
+			CPU_SET(cpus[i], &slot_cpus[slot]);
+		}
+		slot_node[slot] = config->slot_numa ? node_of_cpu[cpus[first]] : -1;
+		log_debug("taskfarm.c: Slot %d has %d CPUs from CPU %d (node %d)",
+			  slot, count, cpus[first], slot_node[slot]);
+	}
+}
 
-		opt_task_clean_up();
-	} else {
-		log_error
-		    ("Not the master process, yet the master() function was called.");
+/* In a slot's process: bind ourselves, and so our commands, to the slot */
+static void opt_task_pin_slot(int slot)
+{
+	unsigned long nodemask;
+
+	if (slot_cpus == NULL) {
+		return;
+	}
+	if (sched_setaffinity(0, sizeof(slot_cpus[slot]), &slot_cpus[slot]) < 0) {
+		log_warn("Unable to pin slot %d: %s", slot, strerror(errno));
+	}
+	if (slot_node[slot] >= 0
+	    && slot_node[slot] < (int)(8 * sizeof(nodemask))) {
+		nodemask = 1UL << slot_node[slot];
+		if (syscall(SYS_set_mempolicy, OPT_TASK_MPOL_BIND, &nodemask,
+			    8 * sizeof(nodemask)) < 0) {
+			log_warn("Unable to bind slot %d to NUMA node %d: %s",
+				 slot, slot_node[slot], strerror(errno));
+		}
 	}
 }
 
-int prologue(const char * format, char * flags, double * time)
+/* Used by slots to serialise their benchmarks with flock(2) */
+static void opt_task_create_bench_lock(void)
 {
-	int retval = 1;
-	char * command = NULL;
-	int size = strlen(flags) + strlen(format) + 1; /* The +1 is for '\0' */
+	int fd;
+	char lock_template[] = "/tmp/optsearch-lock-XXXXXX";
 
-	if (!stop_work) {
-		command = realloc(command, size + strlen(config->clean_script));
-		sprintf(command, format, flags, config->clean_script);
-		log_debug("taskfarm.c: Clean command is %s.", command);
-		retval = run_command(command, time, config->timeout);
-		if (retval == 0) {
-			command = realloc(command, size + strlen(config->build_script));
-			sprintf(command, format, flags, config->build_script);
-			log_debug("taskfarm.c: Build command is %s.", command);
-			retval = run_command(command, time, config->timeout);
-			if (retval == 0) {
-				command = realloc(command, size + strlen(config->accuracy_test));
-				sprintf(command, format, flags, config->accuracy_test);
-				log_debug("taskfarm.c: Test command is %s.", command);
-				retval = run_command(command, time, config->timeout);
+	fd = mkstemp(lock_template);
+	if (fd < 0) {
+		log_fatal("Unable to create benchmark lock file: %s",
+			  strerror(errno));
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	close(fd);
+	local_lock_path = strdup(lock_template);
+}
+
+static void opt_task_remove_bench_lock(void)
+{
+	if (local_lock_path != NULL) {
+		unlink(local_lock_path);
+		free(local_lock_path);
+		local_lock_path = NULL;
+	}
+}
+
+/*
+ * What each slot's forked process does: the same as a worker that both
+ * builds and benchmarks, writing the result to fd rather than sending it.
+ * It must not return, nor touch anything MPI has set up.
+ */
+static void opt_task_slot_evaluate(int slot, opt_work_item_t * item, int fd)
+{
+	opt_task_result_t result;
+	opt_task_incumbent_t incumbent;
+	char *flags = NULL;
+	int retval, signum, lock = -1;
+
+	/* Only the parent acts on the quit signal, or talks to the master */
+	signum = opt_get_signum(config->quit_signal);
+	if (signum > 0) {
+		signal(signum, SIG_DFL);
+	}
+	set_child_wait_hook(NULL);
+	set_command_pgid_record(&slot_pgid[slot]);
+	in_slot = true;
+	opt_task_set_slot_env(slot_env_base + slot);
+	opt_task_pin_slot(slot);
+
+	flags = opt_flags_to_string(num_dims, dim_flags, item->position);
+	opt_task_prepare_evaluation(flags, item->position);
+	opt_task_clear_result(&result);
+	retval = prologue(&result, item->message[OPT_HEADER_BUILD_TIMEOUT]);
+	if (retval == 0 && !result.reused) {
+		if (local_lock_path != NULL) {
+			/* Our own open, so that the lock is not shared */
+			lock = open(local_lock_path, O_RDWR);
+			if (lock >= 0) {
+				flock(lock, LOCK_EX);
 			}
 		}
+		memcpy(&incumbent, item->message + OPT_HEADER_INCUMBENT,
+		       sizeof(incumbent));
+		retval = benchmark(&incumbent, &result,
+				   item->message[OPT_HEADER_BENCH_TIMEOUT]);
+		if (lock >= 0) {
+			close(lock);
+		}
+	}
+	result.seq = item->message[OPT_HEADER_SEQ];
+	if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+		log_error("Slot %d was unable to report its result: %s", slot,
+			  strerror(errno));
+	}
+	_exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
 
-		if (retval) {
-			*time = DBL_MAX;
+static void opt_task_slot_launch(int slot, opt_work_item_t * item)
+{
+	int i, fds[2];
+	pid_t pid;
+
+	/* Only this slot's process writes the result, not what it runs */
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		log_fatal("Unable to create pipe for slot %d: %s", slot,
+			  strerror(errno));
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	fflush(NULL);
+	slot_pgid[slot] = 0;
+	pid = fork();
+	if (pid < 0) {
+		log_fatal("Unable to fork process for slot %d: %s", slot,
+			  strerror(errno));
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (i = 0; i < num_slots; i++) {
+			if (slots[i].pid > 0) {
+				close(slots[i].fd);
+			}
 		}
+		opt_task_slot_evaluate(slot, item, fds[1]);
 	}
+	close(fds[1]);
+	log_trace("taskfarm.c: Slot %d (pid %d) is evaluating particle %d",
+		  slot, pid, item->uid);
+	slots[slot].pid = pid;
+	slots[slot].fd = fds[0];
+	slots[slot].item = item;
+}
 
-	return retval;
+/*
+ * A slot's process has finished, or has been killed.  Anything short of a
+ * whole result counts as a failed evaluation.  The slot is then free, and
+ * its item is returned.
+ */
+static opt_work_item_t *opt_task_slot_collect(int slot,
+					       opt_task_result_t * result)
+{
+	opt_work_item_t *item = slots[slot].item;
+	ssize_t count = 0;
+	ssize_t rc;
+
+	while (count < (ssize_t) sizeof(*result)) {
+		rc = read(slots[slot].fd, (char *)result + count,
+			  sizeof(*result) - count);
+		if (rc < 0 && errno == EINTR) {
+			continue;
+		}
+		if (rc <= 0) {
+			break;
+		}
+		count += rc;
+	}
+	if (count != (ssize_t) sizeof(*result)) {
+		log_error("Slot %d exited without a result for particle %d",
+			  slot, item->uid);
+		opt_task_clear_result(result);
+		result->seq = item->message[OPT_HEADER_SEQ];
+	}
+	close(slots[slot].fd);
+	while (waitpid(slots[slot].pid, NULL, 0) < 0 && errno == EINTR) ;
+	slots[slot].pid = 0;
+	slots[slot].fd = -1;
+	slots[slot].item = NULL;
+
+	return item;
 }
 
-int benchmark(const char * format, char * flags, double * time)
+/*
+ * Kill a slot's process, and the command it is running, which is in a
+ * process group of its own (see spawn_command), and so would carry on
+ * without the slot.  The slot is left to be collected.
+ */
+static void opt_task_slot_kill(int slot)
 {
-	int retval = 1;
-	int i;
-	double stdev = 0.0;
-	double perc = 0.0;
-	double value = 0.0;
-	double * values = NULL;
-	char * command = NULL;
-	int size = strlen(flags) + strlen(format) + strlen(config->perf_test) + 1; /* The +1 is for '\0' */
-	if (config->benchmark_repeats == 0) {
-		/* Assume that if nothing was set in the config, the user intended to
-		 * run the test once. */
-		config->benchmark_repeats = 1;
+	pid_t pgid = slot_pgid[slot];
+
+	if (pgid > 0) {
+		kill(-pgid, SIGKILL);
 	}
-	values = calloc(sizeof(*values), config->benchmark_repeats);
+	kill(slots[slot].pid, SIGKILL);
+}
 
-	if (!stop_work) {
-		command = realloc(command, size);
-		sprintf(command, format, flags, config->perf_test);
-		log_debug("taskfarm.c: Benchmark command is %s.", command);
+/* Wait up to timeout ms for slots to finish, and hand each to collect */
+static void opt_task_slots_wait(int timeout, void (*collect) (int))
+{
+	int slot, i, n = 0, rc;
+
+	for (slot = 0; slot < num_slots; slot++) {
+		if (slots[slot].pid > 0) {
+			slot_fds[n].fd = slots[slot].fd;
+			slot_fds[n].events = POLLIN;
+			slot_fds[n].revents = 0;
+			slot_of_fd[n] = slot;
+			n++;
+		}
+	}
+	rc = poll(slot_fds, n, timeout);
+	if (rc < 0 && errno != EINTR) {
+		log_fatal("poll failed: %s", strerror(errno));
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (i = 0; rc > 0 && i < n; i++) {
+		if (slot_fds[i].revents != 0) {
+			collect(slot_of_fd[i]);
+		}
+	}
+}
 
-		for (i=0; i < config->benchmark_repeats; i++) {
-			/*
-			 * This one MUST be repeated either config->benchmark_repeat
-			 * times, OR if 4 runs have a standard deviation <= config->epsilon,
-			 * then we should report the mean time, not the time of just one run.
-			 */
-			retval = run_command(command, &value, config->benchmark_timeout);
-			if (retval) {
-				log_error("Error encountered attempting to run the benchmark.");
-				*time = DBL_MAX;
+static int opt_task_slots_busy(void)
+{
+	int slot, busy = 0;
+
+	for (slot = 0; slot < num_slots; slot++) {
+		if (slots[slot].pid > 0) {
+			busy++;
+		}
+	}
+	return busy;
+}
+
+static void opt_task_local_launch(int slot, opt_work_item_t * item)
+{
+	item->message[OPT_HEADER_SEQ] = opt_get_msg_seq();
+	opt_task_stamp_header(item);
+	opt_task_slot_launch(slot, item);
+	opt_task_start_item(item);
+}
+
+static void opt_task_local_collect(int slot)
+{
+	opt_task_result_t result;
+	opt_work_item_t *item = opt_task_slot_collect(slot, &result);
+
+	item->elapsed += MPI_Wtime() - item->started;
+	opt_task_record_result(item, &result, false);
+	opt_task_finish_item(item, &result);
+}
+
+/* Fill the free slots from the queue, topping up with speculative work */
+static void opt_task_local_dispatch(void)
+{
+	int slot, num_free = 0;
+	opt_work_item_t *item = NULL;
+	bool asked = false;
+
+	for (;;) {
+		for (slot = 0; slot < num_slots && !stop_work; slot++) {
+			if (slots[slot].pid > 0) {
+				continue;
+			}
+			item = opt_task_take(&queue_front, &queue_back,
+					     &queue_size, true);
+			if (item == NULL) {
+				break;
+			}
+			opt_task_local_launch(slot, item);
+		}
+		if (stop_work || asked || idle_listener == NULL
+		    || queue_size > 0) {
+			return;
+		}
+		num_free = num_slots - opt_task_slots_busy();
+		if (num_free == 0) {
+			return;
+		}
+		idle_listener(num_free);
+		asked = true;
+	}
+}
+
+/*
+ * The task farm for a single rank.  As with the master, everything is
+ * driven by results arriving, but here they arrive on the pipes from our
+ * own forked processes.  When told to stop, we wait for what is running to
+ * finish, as the master does for its workers.
+ */
+void local_executor(void)
+{
+	int slot;
+	double now;
+
+	stop_work = false;
+	log_info("taskfarm.c: No MPI workers, so running %d evaluations at a time on this node",
+		 num_slots);
+	if (config->benchmark_workers > 0) {
+		log_warn("benchmark-workers is ignored without MPI workers");
+	}
+	if (config->exclusive_benchmark) {
+		opt_task_create_bench_lock();
+	}
+	opt_task_plan_slots();
+
+	for (;;) {
+		wake_master = 0;
+		opt_task_local_dispatch();
+		if (stop_work && opt_task_slots_busy() == 0) {
+			log_trace("taskfarm.c: All slots are idle and we have been told to stop.  Stopping.");
+			break;
+		}
+
+		/* Come back every so often, to check deadlines and the queue */
+		opt_task_slots_wait(1000, opt_task_local_collect);
+
+		now = MPI_Wtime();
+		for (slot = 0; slot < num_slots; slot++) {
+			if (slots[slot].pid > 0
+			    && now > slots[slot].item->deadline) {
+				log_error
+				    ("Slot %d is past the deadline for particle %d; killing it.",
+				     slot, slots[slot].item->uid);
+				opt_task_slot_kill(slot);
+				opt_task_local_collect(slot);
+			}
+		}
+	}
+
+	opt_task_remove_bench_lock();
+	opt_task_clean_up();
+}
+
+/* A multi-slot worker's slot has finished; tell the master */
+static void opt_task_worker_collect(int slot)
+{
+	opt_task_result_t result;
+	opt_work_item_t *item = opt_task_slot_collect(slot, &result);
+
+	log_trace("taskfarm.c: Sending fitness %lf for seq #%d back to master",
+		  result.fitness, item->message[OPT_HEADER_SEQ]);
+	/* For the slots started from now on */
+	opt_task_remember_build(&result);
+	/* The master reposts its receive as soon as it has each result */
+	MPI_Send(&result, 1, result_type, MASTER, OPT_TASK_MSG_TAG,
+		 MPI_COMM_WORLD);
+	free(item->message);
+	free(item);
+}
+
+/*
+ * A worker with config->slots_per_worker slots runs that many items at
+ * once, each in a forked process as the local executor does, and reports
+ * on each as it finishes, which need not be in the order they were sent.
+ * Items the master sends while every slot is busy wait here for one to
+ * become free.  Benchmarks in the slots are serialised with flock(2) when
+ * exclusive, so there should be only one such worker per node.  A slot
+ * still going at its item's deadline is killed, and the item reported as
+ * failed.
+ */
+static void worker_slots(int my_rank)
+{
+	opt_work_item_t *waiting_front = NULL;
+	opt_work_item_t *waiting_back = NULL;
+	opt_work_item_t *item = NULL;
+	double now;
+	int slot;
+
+	opt_task_alloc_slots(config->slots_per_worker);
+	slot_env_base = my_rank * num_slots;
+	if (config->exclusive_benchmark) {
+		opt_task_create_bench_lock();
+	}
+	opt_task_plan_slots();
+
+	while (!stop_work || opt_task_slots_busy() > 0) {
+		/* Take everything the master has sent us so far */
+		while (!stop_work) {
+			item = calloc(1, sizeof(*item));
+			if (item == NULL) {
+				log_fatal("Unable to allocate memory for work item");
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+			if (opt_task_poll_work(item) != OPT_TASK_WORK_MSG) {
+				free(item->message);
+				free(item);
 				break;
+			}
+			if (waiting_back == NULL) {
+				waiting_front = item;
 			} else {
-				values[i] = value;
-				stdev = standard_deviation(i, values);
-				perc = percent_of_values(config->epsilon, i, values);
-				log_debug("converted %e percent to %e", config->epsilon, perc);
-				if (stdev > perc) {
-					/* Then all is NOT well */
-					log_error("Error (%e) outside of permitted range (%e)%.", stdev, config->epsilon);
-					*time = DBL_MAX;
-					break;
-				}
-				if (i > 4 && stdev <= perc) {
-					/* We don't need to keep going */
-					log_debug("In 4 runs of the benchmark, deviation has stayed at or below expected error.");
-					break;
-				}
+				waiting_back->next = item;
+			}
+			waiting_back = item;
+		}
+
+		for (slot = 0; slot < num_slots && waiting_front != NULL; slot++) {
+			if (slots[slot].pid > 0) {
+				continue;
+			}
+			item = waiting_front;
+			waiting_front = item->next;
+			if (waiting_front == NULL) {
+				waiting_back = NULL;
+			}
+			item->next = NULL;
+			/* Short of the master's deadline, so that a stuck slot
+			 * costs the item rather than the whole worker */
+			opt_task_start_item(item);
+			if (item->deadline < DBL_MAX) {
+				item->deadline -= OPT_TASK_DEADLINE_GRACE / 2;
+			}
+			opt_task_slot_launch(slot, item);
+		}
+
+		opt_task_heartbeat();
+		opt_task_slots_wait(OPT_TASK_SLOT_POLL_MS, opt_task_worker_collect);
+
+		now = MPI_Wtime();
+		for (slot = 0; slot < num_slots; slot++) {
+			if (slots[slot].pid > 0
+			    && now > slots[slot].item->deadline) {
+				log_error
+				    ("Slot %d is past the deadline for particle %d; killing it.",
+				     slot, slots[slot].item->uid);
+				opt_task_slot_kill(slot);
+				opt_task_worker_collect(slot);
 			}
 		}
-		*time = mean(i, values);
 	}
 
-	return retval;
+	opt_task_remove_bench_lock();
+	opt_task_clean_up();
 }
 
 void worker(void)
@@ -676,17 +3861,24 @@ void worker(void)
 	int my_rank, len;
     char processorname[MPI_MAX_PROCESSOR_NAME] = { '\0' };
 
-	/* Each command should be run as:
+	/* Each command is run with the flags in its environment, as if by:
 	 *      FLAGS="-fblah -ffoo -fquux" compile.sh
 	 * It is up to the user to ensure that the scripts run correctly in this
 	 * way and are able to give a useful return value.
 	 */
-	const char *const command_format = "FLAGS=\"%s\" %s";
 
 	int retval = -1;
-	double time = 0.0;
+	opt_task_result_t result;
+	opt_task_result_t sent;	/* For as long as the send is in flight */
+	opt_task_incumbent_t incumbent;
+	MPI_Request result_send = MPI_REQUEST_NULL;
+	char *flags = NULL;
+	opt_task_role_e role;
 	opt_work_item_t item;
-	item.command = NULL;
+	item.message = NULL;
+	item.position = NULL;
+	item.artifact = NULL;
+	item.artifact_size = 0;
 
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
 	if (MASTER == my_rank) {
@@ -697,6 +3889,14 @@ void worker(void)
     MPI_Get_processor_name(processorname, &len);
     processorname[len] = '\0';
 	log_trace("taskfarm.c: Entered worker function on node %s.", processorname);
+	role = opt_task_get_role(my_rank);
+	if (config->slots_per_worker > 1) {
+		stop_work = false;
+		worker_slots(my_rank);
+		return;
+	}
+	set_child_wait_hook(&opt_task_heartbeat);
+	opt_task_set_slot_env(my_rank);
 
 	/* Minimal tasks for workers:
 	 * - Receive first work item from master, and the base set of things to
@@ -718,6 +3918,10 @@ void worker(void)
 	 * - Clean up when signal is received, or if NULL work item is received
 	 */
 
+	/* As on the master, a previous run of the task farm in this process
+	 * will have left this set */
+	stop_work = false;
+
 	/* Receive the first work item */
 	log_trace("taskfarm.c: Worker probing for first work item");
 	opt_task_receive_work(&item);
@@ -725,16 +3929,39 @@ void worker(void)
 
 	/* Do the work */
 	while (!stop_work) {
-		retval = prologue(command_format, item.command, &time);
-		if (retval == 0) {
-			/* Run the benchmark */
-			retval = benchmark(command_format, item.command, &time);
+		flags = opt_flags_to_string(num_dims, dim_flags, item.position);
+		opt_task_prepare_evaluation(flags, item.position);
+		opt_task_clear_result(&result);
+		if (item.message[OPT_HEADER_TYPE] == OPT_TASK_BENCH_MSG) {
+			/* Someone else has built it for us */
+			retval = opt_task_unpack_artifact(&item, &result);
+		} else {
+			retval = prologue(&result,
+					  item.message[OPT_HEADER_BUILD_TIMEOUT]);
+			if (retval == 0 && role == OPT_TASK_BUILDER
+			    && !result.reused) {
+				/* Leave the benchmark to a benchmarker */
+				retval = opt_task_pack_artifact(&item);
+			}
 		}
+		if (retval == 0 && role != OPT_TASK_BUILDER && !result.reused) {
+			/* Run the benchmark, once nobody else on the node is */
+			opt_task_acquire_benchmark(item.uid);
+			memcpy(&incumbent, item.message + OPT_HEADER_INCUMBENT,
+			       sizeof(incumbent));
+			retval = benchmark(&incumbent, &result,
+					   item.message[OPT_HEADER_BENCH_TIMEOUT]);
+		}
+		free(flags);
+		flags = NULL;
 
         if (retval != 0) {
             log_info("One of our commands appears to have failed (non-zero exit status).");
-            time = DBL_MAX;
-        }
+            result.fitness = DBL_MAX;
+        } else if (role == OPT_TASK_BUILDER && !result.reused) {
+		/* Built and tested; the benchmarker will give the fitness */
+		result.fitness = result.wall_time[BUILD_POS];
+	}
 
 		/* 
 		 * Report results to MASTER and receive the next work item.
@@ -749,18 +3976,39 @@ void worker(void)
 			break;
 		}
 		log_trace("taskfarm.c: Sending fitness %lf back to master",
-			  time);
-		/* TODO
-		 * If this is a blocking send, we could have a deadlock here if we
-		 * are sent a STOP message from the master before we can MPI_Recv */
-		MPI_Send(&time, 1, MPI_DOUBLE, MASTER, OPT_TASK_MSG_TAG,
-			 MPI_COMM_WORLD);
+			  result.fitness);
+		/* The master only ever has one receive posted for our results, so
+		 * the previous one must have gone before we send another. */
+		MPI_Wait(&result_send, MPI_STATUS_IGNORE);
+		result.seq = item.message[OPT_HEADER_SEQ];
+		sent = result;
+		MPI_Isend(&sent, 1, result_type, MASTER, OPT_TASK_MSG_TAG,
+			  MPI_COMM_WORLD, &result_send);
+		if (role == OPT_TASK_BUILDER && retval == 0 && !result.reused
+		    && config->staging_dir == NULL) {
+			/* The master passes this on to a benchmarker */
+			MPI_Send(item.artifact, item.artifact_size, MPI_BYTE,
+				 MASTER, OPT_TASK_ARTIFACT_TAG, MPI_COMM_WORLD);
+		}
 
+		/* The master may well have sent this already, while we were busy */
 		log_trace("taskfarm.c: Waiting for next work item from master");
 		opt_task_receive_work(&item);
 	}
-	free(item.command);
-	item.command = NULL;
+
+	/* If we stopped because of a signal rather than being told to by the
+	 * master, our last result may not have gone. */
+	if (result_send != MPI_REQUEST_NULL) {
+		MPI_Request_free(&result_send);
+	}
+	if (heartbeat_send != MPI_REQUEST_NULL) {
+		MPI_Request_free(&heartbeat_send);
+	}
+	set_child_wait_hook(NULL);
+	free(item.message);
+	item.message = NULL;
+	free(item.artifact);
+	item.artifact = NULL;
 	opt_task_clean_up();
 }
 
@@ -774,10 +4022,30 @@ void opt_task_start(void)
 		log_fatal("Cannot start task farm without config");
 		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
-	if (size < 2) {
-		log_fatal("Cannot start task farm at least one worker (so a minimum of 2 MPI ranks)");
+	if (size == 1) {
+		local_executor();
+		return;
+	}
+	if (config->slots_per_worker > 1 && config->benchmark_workers > 0) {
+		log_fatal("slots-per-worker cannot be used with benchmark-workers");
 		MPI_Abort(MPI_COMM_WORLD, -1);
 	}
+	if (config->benchmark_workers > 0) {
+		if (config->benchmark_workers >= size - 1) {
+			log_fatal("With %d benchmark workers, there are no workers left to build (%d MPI ranks)",
+				  config->benchmark_workers, size);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		if (config->artifact_dir == NULL) {
+			log_fatal("Benchmark workers need artifact-dir to be set in the config");
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		if (MASTER == my_rank) {
+			log_info("taskfarm.c: %d workers will build, and %d will benchmark",
+				 size - 1 - config->benchmark_workers,
+				 config->benchmark_workers);
+		}
+	}
 
 	if (MASTER == my_rank) {
 		master();
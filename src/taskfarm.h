@@ -22,31 +22,167 @@
 
 #include "common.h"
 #include <sys/times.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <regex.h>
 
 #include "config.h"
 
-struct opt_task_work_item_s {
-	int uid;
-	char *command;
-	struct opt_task_work_item_s *next;
-};
+/**
+ * The statistics of the best result so far, which the master copies into
+ * the header of each work item as it sends it, so that with config->racing
+ * the worker can stop repeating the benchmark for a candidate as soon as it
+ * is clearly worse.  The mean is of its benchmark runs, whichever
+ * config->aggregate it was scored by, and like a fitness lower is better.
+ */
+typedef struct {
+	double mean;
+	double stddev;
+	double repeats;	/* 0 while there is no incumbent */
+} opt_task_incumbent_t;
 
-typedef struct opt_task_work_item_s opt_work_item_t;
+#define OPT_INCUMBENT_INTS (sizeof(opt_task_incumbent_t) / sizeof(int))
 
 typedef enum opt_header_position_e {
 	OPT_HEADER_TYPE = 0,
 	OPT_HEADER_UID = 1,
 	OPT_HEADER_SIZE = 2,
 	OPT_HEADER_SEQ = 3,
+	OPT_HEADER_ARTIFACT = 4,	/* For benchmark messages, the seq of the build */
+	OPT_HEADER_BUILD_TIMEOUT = 5,	/* In seconds, set by the master as it sends */
+	OPT_HEADER_BENCH_TIMEOUT = 6,
+	OPT_HEADER_INCUMBENT = 7,	/* An opt_task_incumbent_t, also set as it sends */
+	OPT_HEADER_LENGTH = 7 + OPT_INCUMBENT_INTS,
 } opt_header_position;
 
+/** The stages of an evaluation, in the order they are run */
+typedef enum {
+	QUIT_POS = 0,
+	CLEAN_POS = 1,
+	BUILD_POS = 2,
+	TEST_POS = 3,
+	BENCH_POS = 4
+} opt_task_position_e;
+
+#define OPT_TASK_STAGES (BENCH_POS + 1)
+
+/** At most this many of the benchmark's runs are reported individually */
+#define OPT_RESULT_MAX_SAMPLES 64
+
+/**
+ * Workers report on each item with one of these, sent as a single MPI
+ * derived datatype.  The master adapts the timeouts it sends from the build
+ * and benchmark times, keeps the benchmark's statistics for the incumbent,
+ * and hands the whole to the result listener, to be kept for working out
+ * later where the time went and why candidates failed.  The doubles come
+ * first, then the build's hash and the ints, so that the datatype is just
+ * three blocks.
+ */
+typedef struct {
+	double fitness;	/* DBL_MAX if any stage failed */
+	double bench_time;	/* Mean elapsed time of one benchmark run */
+	double stddev;	/* Of the fitness over the benchmark runs */
+	/* The mean of those runs, which is what racing compares, as fitness
+	 * may be another aggregate (DBL_MAX if not benchmarked) */
+	double mean;
+	/* The node's load average, CPU busy percentage and frequency just
+	 * before the benchmark (-1 if not known), to tell a noisy result from
+	 * a slow candidate */
+	double load;
+	double busy;
+	double freq;
+	/* Elapsed, user and system time, and peak RSS (KiB), of each stage by
+	 * opt_task_position_e.  The benchmark's cover all its runs, warm-up
+	 * included.  All 0 for a stage not run here. */
+	double wall_time[OPT_TASK_STAGES];
+	double user_time[OPT_TASK_STAGES];
+	double system_time[OPT_TASK_STAGES];
+	double max_rss[OPT_TASK_STAGES];
+	double samples[OPT_RESULT_MAX_SAMPLES];	/* Each run's fitness, as measured */
+	/* Of the files matching config->artifact_glob after the build, or 0
+	 * if they were not hashed */
+	uint64_t build_hash;
+	/* Of the item's message, as workers with several slots report in
+	 * whatever order their items finish */
+	int seq;
+	int stage;	/* The last stage run, an opt_task_position_e */
+	int status;	/* Its exit status, or -1 if it did not exit */
+	int signal;	/* The signal that ended it, or 0 */
+	int timed_out;
+	int noisy;	/* The benchmark runs varied by more than config->epsilon */
+	int cached;	/* The build came from the build cache, not clean and build */
+	/* The same build had already been tested and benchmarked, so its
+	 * result was given instead (see config->artifact_glob) */
+	int reused;
+	int repeats;
+	int num_samples;
+} opt_task_result_t;
+
+/**
+ * Workers are sent their next item while still busy with the current one,
+ * so that they can start on it as soon as they finish.  This is the number
+ * of items a single worker may have outstanding at once.
+ */
+#define OPT_TASK_PREFETCH_DEPTH 2
+
+/**
+ * A work item is the position of a particle, which the workers turn into
+ * FLAGS themselves.  It is sent as a single message of ints: the header,
+ * whose OPT_HEADER_SIZE is the number of values in the position, followed by
+ * the position itself.
+ */
+struct opt_task_work_item_s {
+	int uid;
+	int *message;	/* The header followed by the position */
+	int *position;	/* Points into message, after the header */
+	/* The request for the nonblocking send of the message, which must stay
+	 * allocated until the send is known to be complete; that is once the
+	 * worker reports back. */
+	MPI_Request request;
+	/* A tar archive of the build, when it is passed to a benchmarker over
+	 * MPI rather than through the staging directory */
+	char *artifact;
+	int artifact_size;
+	MPI_Request artifact_request;
+	/* Used by the master to schedule the queue: the priority given by the
+	 * listener (lower first), the predicted cost in seconds, and timing of
+	 * this evaluation so far.  The worker is given up on if it has not
+	 * reported by the deadline. */
+	double priority;
+	double cost;
+	double started;
+	double elapsed;
+	double deadline;
+	/* Speculative items only go to otherwise idle workers, and after
+	 * everything else in the queue */
+	bool speculative;
+	/* Once built by a builder, the hash of its build, for the result of
+	 * the benchmark to be known by */
+	uint64_t build_hash;
+	struct opt_task_work_item_s *next;
+};
+
+typedef struct opt_task_work_item_s opt_work_item_t;
+
 /** Values to use for MPI_TAG.  Actual numeric values are arbitrary choices
  * given to make debugging output more legible. */
 typedef enum opt_task_tag_e {
-	OPT_TASK_HEADER_TAG = 6,
-			     /** Headers give information on what is coming in the message to follow */
 	OPT_TASK_MSG_TAG = 4,
-			  /** Signifies a message (body) rather than a header is being sent/received */
+			  /** Work items from the master and results from the workers */
+	OPT_TASK_BENCH_REQUEST_TAG = 5,
+			  /** A worker asking to start its benchmark */
+	OPT_TASK_BENCH_GRANT_TAG = 3,
+			  /** The master allowing a worker to start its benchmark */
+	OPT_TASK_ARTIFACT_TAG = 2,
+			  /** The archived build, from builder to master to benchmarker */
+	OPT_TASK_HEARTBEAT_TAG = 6,
+			  /** A busy worker telling the master it is still alive */
+	OPT_TASK_BUILD_QUERY_TAG = 7,
+			  /** A worker asking whether its build has a result already */
+	OPT_TASK_BUILD_REPLY_TAG = 8,
+			  /** The master's answer, with the result if so */
 } opt_task_tag_t;
 
 /**
@@ -57,6 +193,7 @@ typedef enum opt_task_msg_e {
 	OPT_TASK_WORK_MSG = 9,
 	OPT_TASK_RESULT_MSG = 8,
 	OPT_TASK_STOP_MSG = 7,
+	OPT_TASK_BENCH_MSG = 10,	/* Benchmark something already built */
 } opt_task_msg_t;
 
 /**
@@ -68,14 +205,44 @@ typedef enum opt_task_msg_e {
  * run.  This function takes a UID for the particle in PSO that provided this
  * work item, and a double representing the fitness for that point.
  *
+ * The master also gives the number of dimensions of the search space, and
+ * the uid of the flag that each dimension corresponds to.  These are
+ * broadcast to the workers (which may pass 0 and NULL), so that they can turn
+ * the positions they are sent into FLAGS using the flags in the config.
+ *
  * @param config the opt_config_t
+ * @param num_dims the number of dimensions of each position
+ * @param flag_uids the uid of the flag for each dimension
  * @param report_fitness a pointer to the function to call to report back the
  * fitness score
  *
  */
-int opt_task_initialise(opt_config_t * config,
+int opt_task_initialise(opt_config_t * config, int num_dims,
+			const int *flag_uids,
 			int (*report_fitness) (const int, double, int));
 
+/**
+ * Register a function giving the priority of a work item, by its UID, for
+ * the best-first scheduler.  Lower values are handed out first.  It is
+ * called as each item is queued, on the master only.
+ *
+ * @param priority the function, or NULL for all items to be equal
+ */
+void opt_task_set_priority(double (*priority) (const int));
+
+/**
+ * Register a function to be given every result the workers send, along with
+ * the UID and position of the work item, once the fitness has been
+ * reported.  With separate builders and benchmarkers, each sends its own,
+ * and a builder's is given as soon as it arrives, without a fitness.  It
+ * is called on the master only.
+ *
+ * @param listener the function, or NULL for none
+ */
+void opt_task_set_result_listener(void (*listener)
+				   (const int, const int *,
+				    const opt_task_result_t *));
+
 /**
  * Signal that the taskfarm should stop waiting for more work, and stop
  * processing anything remaining in the queue.
@@ -91,14 +258,45 @@ int opt_task_clean_up(void);
  * Adds a work item to the queue.
  *
  * This function takes the UID (usually this corresponds to the PSO particle
- * that generated this work item), the pointer to string representing the
- * command or work item itself.  This string MUST be NULL terminated.
+ * that generated this work item) and the position to evaluate, which must
+ * have as many values as the num_dims given to opt_task_initialise.  The
+ * position is copied.
  *
- * @param work_item a string representing the command to run
  * @param work_item_uid a UID to use when returning the fitness value
+ * @param position the value for each dimension
  * @return the queue size after adding this new item
  */
-int opt_queue_push(const int work_item_uid, const char *work_item);
+int opt_queue_push(const int work_item_uid, const int *position);
+
+/**
+ * As opt_queue_push, but for work that is only worth doing if a worker
+ * would otherwise be idle.  Such items never delay other queued items, and
+ * are never sent to a worker that is busy.
+ */
+int opt_queue_push_speculative(const int work_item_uid, const int *position);
+
+/**
+ * Register a function to be called by the master when workers are idle and
+ * the queue is empty, with the number of idle workers.  It may call
+ * opt_queue_push_speculative to give them something to do.
+ *
+ * @param on_idle the function, or NULL to leave idle workers idle
+ */
+void opt_task_set_idle_listener(void (*on_idle) (int));
+
+/**
+ * The number of evaluations that can run at once: the number of workers,
+ * or with a single MPI rank, the number of local slots.
+ */
+int opt_task_get_num_workers(void);
+
+/**
+ * Take any heartbeats the workers have sent, for when the master is busy
+ * with something other than waiting for results, so that workers are not
+ * given up on for its slowness.  It may be given to set_child_wait_hook.
+ * This should only be invoked by the master rank.
+ */
+void opt_task_take_heartbeats(void);
 
 /**
  * Send a work message to a worker.
@@ -114,7 +312,9 @@ int opt_task_send_to_worker(int worker, opt_task_msg_t type,
 opt_task_msg_t opt_task_receive_work(opt_work_item_t * item);
 
 /**
- * Start the task farm.
+ * Start the task farm.  With more than one MPI rank, the master hands out
+ * work to the others.  With only one, evaluations are run in forked
+ * processes on this node instead (see config->local_slots).
  */
 void opt_task_start(void);
 
@@ -4,4 +4,8 @@ echo "Build script called with FLAGS=\"$FLAGS\""
 
 sleep 2
 
+mkdir -p build-output
+# Only some of the flags make a difference to the build
+echo "$FLAGS" | cut -d ' ' -f 1-3 > build-output/binary
+
 exit 0
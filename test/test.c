@@ -8,6 +8,7 @@
 #endif
 #include <string.h>
 #include <math.h>
+#include <utime.h>
 
 #ifndef PI
 #ifdef M_PI
@@ -26,6 +27,7 @@
 #include "data.h"
 #include "spso.h"
 #include "optimiser.h"
+#include "stats.h"
 
 /* TODO Refactor; this is the bare minimum of what is needed.
  *
@@ -37,13 +39,14 @@
  * project's example:
  * http://cunit.sourceforge.net/example.html
  */
-const char *test_flags1 = "test flags 1";
-const char *test_flags2 = "test flags 2 ";
-const char *test_flags3 = "test flags 3 ";
-const char *test_flags4 = "test flags 4 ";
-const char *test_flags5 = "test flags 5 ";
-const char *test_flags6 = "test flags 6 ";
-const char *test_flags7 = "test flags 7 ";
+/* Positions for the task farm test, which has an onoff and a range flag */
+const int test_position1[] = { 1, 3 };
+const int test_position2[] = { 0, 2 };
+const int test_position3[] = { 1, 0 };
+const int test_position4[] = { 0, 1 };
+const int test_position5[] = { 1, 8 };
+const int test_position6[] = { 0, 9 };	/* Out of range */
+const int test_position7[] = { 1, 4 };
 
 /* Helper functions */
 spso_velocity_t *opt_test_new_velocity(int num_dims, spso_dimension_t ** dims)
@@ -132,20 +135,48 @@ int report_fitness(const int x, double y, int visits)
 	 * have been visited before. */
 
 	if (x == 12)
-		opt_queue_push(34, test_flags5);
+		opt_queue_push(34, test_position5);
 	else if (x == 13)
-		opt_queue_push(78, test_flags6);
+		opt_queue_push(78, test_position6);
 	else if (x == 78)
-		opt_queue_push(90, test_flags7);
+		opt_queue_push(90, test_position7);
 	else if (x == 90)
 		opt_task_stop();
 
 	return 0;
 }
 
+/* Whatever the worker's role, a result says how it got there */
+void report_result(const int uid, const int *position,
+		   const opt_task_result_t * result)
+{
+	log_debug("Received result for uid %d: stage %d, status %d.", uid,
+		  result->stage, result->status);
+	assert(position != NULL);
+	if (result->fitness < DBL_MAX) {
+		/* Only a benchmark gives a fitness, not a builder's build */
+		assert(result->stage == BENCH_POS);
+		assert(0 == result->status && 0 == result->signal);
+		/* Unless the same build had been benchmarked already */
+		assert(result->reused || result->wall_time[result->stage] > 0.0);
+	}
+	if (result->cached) {
+		/* Unpacked from the build cache instead */
+		assert(0.0 == result->wall_time[CLEAN_POS]);
+		assert(0.0 == result->wall_time[BUILD_POS]);
+	}
+	if (result->stage == BENCH_POS && result->fitness < DBL_MAX) {
+		assert(result->repeats > 0);
+		assert(result->num_samples == result->repeats);
+		assert(result->bench_time > 0.0);
+	}
+}
+
 int test_taskfarm(int rank)
 {
 	opt_config_t * config = NULL;
+	char *flags = NULL;
+	int flag_uids[2];
 
 	log_info("Starting taskfarm test");
 	config = opt_new_config();
@@ -166,16 +197,60 @@ int test_taskfarm(int rank)
 		config->epsilon = 2.0;
 		config->benchmark_timeout = 10;
 		config->benchmark_repeats = 8;
-		config->compiler_flags = NULL;	/* The task farm doesn't use this itself */
+		config->benchmark_timeout_factor = 10.0;
+		/* All our ranks are on one node, so benchmarks run one at a time */
+		config->exclusive_benchmark = true;
+		/* One worker benchmarks what the other two build, with the builds
+		 * being passed over MPI */
+		config->benchmark_workers = 1;
+		config->artifact_dir = strdup("./test-artifact");
+		mkdir(config->artifact_dir, 0755);
+		config->scheduler = OPT_SCHEDULER_COST_AWARE;
+		/* The builds take two seconds, so workers should be heard from */
+		config->heartbeat_interval = 1;
+		/* The workers use these to turn positions into FLAGS */
+		config->num_flags = 2;
+		config->compiler_flags =
+		    malloc(config->num_flags * sizeof(*config->compiler_flags));
+		config->compiler_flags[0] =
+		    new_onoff_flag("unroll-loops", "-f", "-fno-");
+		config->compiler_flags[1] =
+		    new_range_flag("max-unroll-times", "--param ", "=", 8, 0, 4);
+		config->compiler_flags[1]->default_value = "4";
 	}
 
 	opt_share_config(MASTER, config);
 
-	opt_task_initialise(config, &report_fitness);
+	assert(config->num_flags == 2);
+	flags = opt_flags_to_string(config->num_flags, config->compiler_flags,
+				    test_position1);
+	assert(!strcmp(flags, " -funroll-loops --param max-unroll-times=3"));
+	free(flags);
+	flags = opt_flags_to_string(config->num_flags, config->compiler_flags,
+				    test_position6);
+	assert(!strcmp(flags, " -fno-unroll-loops"));
+	free(flags);
+	/* In order, and leaving out max-unroll-times at its default of 4 */
+	flags = opt_flags_to_canonical_string(config->num_flags,
+					      config->compiler_flags,
+					      test_position1);
+	assert(!strcmp(flags, " --param max-unroll-times=3 -funroll-loops"));
+	free(flags);
+	flags = opt_flags_to_canonical_string(config->num_flags,
+					      config->compiler_flags,
+					      test_position7);
+	assert(!strcmp(flags, " -funroll-loops"));
+	free(flags);
+
+	flag_uids[0] = config->compiler_flags[0]->uid;
+	flag_uids[1] = config->compiler_flags[1]->uid;
+	opt_task_initialise(config, config->num_flags, flag_uids,
+			    &report_fitness);
 	if (rank == MASTER) {
-		opt_queue_push(11, test_flags1);
-		opt_queue_push(12, test_flags2);
-		opt_queue_push(13, test_flags3);
+		opt_task_set_result_listener(&report_result);
+		opt_queue_push(11, test_position1);
+		opt_queue_push(12, test_position2);
+		opt_queue_push(13, test_position3);
 	}
 
 	opt_task_start();
@@ -524,6 +599,29 @@ int test_config(void)
 	assert(strncmp("./perf-script.sh", config->perf_test, 16) == 0);
 	assert(240 == config->benchmark_timeout);
 	assert(6 == config->benchmark_repeats);
+	assert(1 == config->benchmark_warmup);
+	assert(95.0 == config->quiet_threshold);
+	assert(1 == config->quiet_wait);
+	assert(3.0 == config->benchmark_timeout_factor);
+	assert(95 == config->build_timeout_percentile);
+	assert(config->fitness_metric == OPT_METRIC_WALL_TIME);
+	assert(config->aggregate == OPT_AGGREGATE_MAD);
+	assert(config->fitness_pattern == NULL);
+	assert(config->fitness_key == NULL);
+	assert(!config->maximise);
+	assert(config->racing);
+	assert(0.95 == config->race_confidence);
+	assert(config->exclusive_benchmark);
+	assert(config->scheduler == OPT_SCHEDULER_BEST_FIRST);
+	assert(config->speculative);
+	assert(10 == config->heartbeat_interval);
+	assert(2 == config->slots_per_worker);
+	assert(config->pin_slots);
+	assert(!strcmp(config->artifact_dir, "./build-output"));
+	assert(!strcmp(config->build_cache, "./build-cache"));
+	assert(config->shared_build_cache == NULL);
+	assert(!strcmp(config->artifact_glob, "build-output/*"));
+	assert(!strcmp(config->effective_flags, "gfortran -O2"));
 	assert(10.0 == config->epsilon);	/* TODO This is not how you should test equivalence with doubles */
 
 	log_trace("Checking compiler section values..");
@@ -570,6 +668,11 @@ int test_config(void)
 		"named_vars", 10) == 0);
 	assert(strncmp(config->compiler_flags[3]->data.list.values[2], "none", 4) ==
 	       0);
+	assert(!strcmp(config->compiler_flags[3]->default_value, "all"));
+	assert(opt_flag_is_default(config->compiler_flags[3], 0));
+	assert(!opt_flag_is_default(config->compiler_flags[3], 1));
+	assert(config->compiler_flags[0]->default_value == NULL);
+	assert(!opt_flag_is_default(config->compiler_flags[0], 1));
 
 	assert(strncmp(config->compiler_flags[4]->name, "fp-contract", 11) == 0);
 	assert(config->compiler_flags[4]->type == OPT_LIST_FLAG);
@@ -629,6 +732,7 @@ int test_optimiser(int rank)
 	assert(strcmp("./perf-script.sh", config->perf_test) == 0);
 	assert(240 == config->benchmark_timeout);
 	assert(6 == config->benchmark_repeats);
+	assert(config->exclusive_benchmark);
 	assert(10.0 == config->epsilon);	/* TODO This is not how you should test equivalence with doubles */
 
 	log_trace("Checking compiler section values..");
@@ -770,6 +874,243 @@ int test_runcommand(void)
 	return 1;
 }
 
+int test_split_command(void)
+{
+	char **argv = NULL;
+	int status = -1;
+	double time;
+
+	argv = split_command("./build-script.sh 'two words' \"{flags}\"");
+	assert(argv != NULL);
+	assert(strcmp(argv[0], "./build-script.sh") == 0);
+	assert(strcmp(argv[1], "two words") == 0);
+	assert(strcmp(argv[2], "{flags}") == 0);
+	assert(argv[3] == NULL);
+	free_command(argv);
+
+	/* Anything the shell has to do stays with the shell */
+	argv = split_command("FLAGS=x ./success-script.sh > /dev/null");
+	assert(argv != NULL);
+	assert(strcmp(argv[0], SHELL) == 0);
+	assert(strcmp(argv[1], "-c") == 0);
+	assert(strcmp(argv[2], "FLAGS=x ./success-script.sh > /dev/null") == 0);
+	assert(argv[3] == NULL);
+	status = run_command_argv(argv, NULL, &time, 5);
+	assert(0 == status);
+	free_command(argv);
+	argv = split_command("FLAGS=x ./success-script.sh");
+	assert(argv != NULL);
+	assert(strcmp(argv[0], SHELL) == 0);
+	assert(strcmp(argv[2], "FLAGS=x ./success-script.sh") == 0);
+	assert(argv[3] == NULL);
+	free_command(argv);
+	/* An = later on is only an argument */
+	argv = split_command("./build-script.sh --param=1");
+	assert(argv != NULL);
+	assert(strcmp(argv[0], "./build-script.sh") == 0);
+	assert(strcmp(argv[1], "--param=1") == 0);
+	assert(argv[2] == NULL);
+	free_command(argv);
+
+	argv = split_command("./fail-script.sh");
+	status = run_command_argv(argv, NULL, &time, 5);
+	assert(1 == status);
+	free_command(argv);
+
+	return 1;
+}
+
+int test_command_timeout(void)
+{
+	char *sleepy[] = { "./sleepy-script.sh", NULL };
+	char *quick[] = { "sleep", "1.2", NULL };
+	opt_command_usage_t usage;
+	int status = -1;
+	double time;
+
+	/* Killed on time, along with the sleep it started */
+	status = run_command_argv(sleepy, NULL, &time, 1);
+	assert(0 != status);
+
+	/* Noticed as soon as it finishes, not at the next poll, and asleep
+	 * rather than on a CPU for nearly all of it */
+	set_command_counters(true);
+	status = run_command_usage(quick, NULL, &usage, 5);
+	set_command_counters(false);
+	assert(0 == status);
+	assert(usage.wall_time >= 1.2 && usage.wall_time < 1.5);
+	assert(usage.user_time + usage.system_time < 0.5);
+	assert(usage.max_rss > 0);
+	/* The counters may not be available, eg in a VM */
+	assert(usage.task_clock < 0.5);
+
+	return 1;
+}
+
+int test_stats(void)
+{
+	double values[] = { 2.0, 4.0, 4.0, 4.0, 5.0, 5.0, 7.0, 9.0, 100.0 };
+	int n = sizeof(values) / sizeof(values[0]);
+	opt_running_stats_t stats;
+	int i, kept = 0;
+
+	running_stats_init(&stats);
+	for (i = 0; i < n - 1; i++) {
+		running_stats_push(&stats, values[i]);
+	}
+	assert(fabs(stats.mean - 5.0) < 1e-12);
+	assert(fabs(stats.sum - 40.0) < 1e-12);
+	assert(fabs(running_stats_stddev(&stats) - sqrt(32.0 / 7.0)) < 1e-12);
+	assert(2.0 == stats.min && 9.0 == stats.max);
+
+	/* The outlier moves the mean but hardly these */
+	assert(5.0 == median(n, values));
+	assert(5.0 == trimmed_mean(n, values, 0.25));
+	assert(fabs(mad_filtered_mean(n, values, 3.0, &kept) - 5.0) < 1e-12);
+	assert(n - 1 == kept);
+
+	return 1;
+}
+
+/*
+ * An ar archive of two members, the first of odd size so that the second is
+ * only found past the padding, stamped with the given date, uid and gid.
+ */
+void write_archive(const char *path, const char *date, const char *id,
+		   const char *contents)
+{
+	char header[61];
+	FILE *file = NULL;
+
+	file = fopen(path, "w");
+	assert(file != NULL);
+	fputs("!<arch>\n", file);
+	sprintf(header, "%-16s%-12s%-6s%-6s%-8s%-10d`\n", "first.o/", date, id,
+		id, "100644", 3);
+	fputs(header, file);
+	fputs("abc\n", file);
+	sprintf(header, "%-16s%-12s%-6s%-6s%-8s%-10zu`\n", "second.o/", date,
+		id, id, "100644", strlen(contents));
+	fputs(header, file);
+	fputs(contents, file);
+	fclose(file);
+}
+
+/* A 64 bit ELF file of the host's byte order holding only a GNU build ID */
+struct test_elf {
+	Elf64_Ehdr header;
+	Elf64_Nhdr note;
+	char name[4];
+	unsigned char desc[8];
+	Elf64_Shdr section;
+};
+
+void write_elf(const char *path, unsigned char id, unsigned char version)
+{
+	struct test_elf elf;
+	const uint16_t one = 1;
+	FILE *file = NULL;
+
+	memset(&elf, 0, sizeof(elf));
+	memcpy(elf.header.e_ident, ELFMAG, SELFMAG);
+	elf.header.e_ident[EI_CLASS] = ELFCLASS64;
+	elf.header.e_ident[EI_DATA] = *(const unsigned char *)&one ?
+	    ELFDATA2LSB : ELFDATA2MSB;
+	elf.header.e_version = version;
+	elf.header.e_shoff = offsetof(struct test_elf, section);
+	elf.header.e_shentsize = sizeof(elf.section);
+	elf.header.e_shnum = 1;
+	elf.note.n_namesz = sizeof(elf.name);
+	elf.note.n_descsz = sizeof(elf.desc);
+	elf.note.n_type = NT_GNU_BUILD_ID;
+	memcpy(elf.name, "GNU", 4);
+	memset(elf.desc, id, sizeof(elf.desc));
+	elf.section.sh_type = SHT_NOTE;
+	elf.section.sh_offset = offsetof(struct test_elf, note);
+	elf.section.sh_size = sizeof(elf.note) + sizeof(elf.name) +
+	    sizeof(elf.desc);
+
+	file = fopen(path, "w");
+	assert(file != NULL);
+	assert(fwrite(&elf, sizeof(elf), 1, file) == 1);
+	fclose(file);
+}
+
+int test_hash(void)
+{
+	char dir[] = "/tmp/optsearch-test-XXXXXX";
+	char path[MAX_FILENAME_SIZE];
+	char pattern[2 * MAX_FILENAME_SIZE];
+	struct utimbuf epoch = { 0, 0 };
+	uint64_t first = OPT_HASH_INIT;
+	uint64_t second = OPT_HASH_INIT;
+	FILE *file = NULL;
+
+	/* The FNV-1a test vector */
+	assert(0xaf63dc4c8601ec8cULL == hash_bytes(OPT_HASH_INIT, "a", 1));
+
+	assert(mkdtemp(dir) != NULL);
+	snprintf(path, sizeof(path), "%s/source.c", dir);
+	file = fopen(path, "w");
+	assert(file != NULL);
+	fputs("int main(void) { return 0; }\n", file);
+	fclose(file);
+	assert(0 == hash_tree(dir, &first));
+	assert(0 == hash_tree(dir, &second));
+	assert(first == second);
+
+	/* The contents count, not when they were written */
+	file = fopen(path, "w");
+	fputs("int main(void) { return 1; }\n", file);
+	fclose(file);
+	second = OPT_HASH_INIT;
+	assert(0 == hash_tree(dir, &second));
+	assert(first != second);
+
+	/* A build only differs by when it was done */
+	snprintf(pattern, sizeof(pattern), "%s/*.c %s/none*", dir, dir);
+	first = second = OPT_HASH_INIT;
+	assert(1 == hash_build_files(pattern, &first));
+	utime(path, &epoch);
+	assert(1 == hash_build_files(pattern, &second));
+	assert(first == second);
+	unlink(path);
+
+	/* Nor by the dates and owners ar stamps on its members */
+	snprintf(path, sizeof(path), "%s/libtest.a", dir);
+	snprintf(pattern, sizeof(pattern), "%s/libtest.a", dir);
+	write_archive(path, "1500000000", "1000", "int main;\n");
+	first = second = OPT_HASH_INIT;
+	assert(1 == hash_build_files(pattern, &first));
+	write_archive(path, "1700000000", "0", "int main;\n");
+	assert(1 == hash_build_files(pattern, &second));
+	assert(first == second);
+	/* But what is in them still counts */
+	write_archive(path, "1700000000", "0", "int main2;\n");
+	second = OPT_HASH_INIT;
+	assert(1 == hash_build_files(pattern, &second));
+	assert(first != second);
+	unlink(path);
+
+	/* Nor by the linker's build ID */
+	snprintf(path, sizeof(path), "%s/test.o", dir);
+	snprintf(pattern, sizeof(pattern), "%s/test.o", dir);
+	write_elf(path, 0x11, EV_CURRENT);
+	first = second = OPT_HASH_INIT;
+	assert(1 == hash_build_files(pattern, &first));
+	write_elf(path, 0x22, EV_CURRENT);
+	assert(1 == hash_build_files(pattern, &second));
+	assert(first == second);
+	write_elf(path, 0x22, EV_NONE);
+	second = OPT_HASH_INIT;
+	assert(1 == hash_build_files(pattern, &second));
+	assert(first != second);
+	unlink(path);
+
+	rmdir(dir);
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
 	int rank, len;
@@ -792,6 +1133,10 @@ int main(int argc, char **argv)
 
 	if (MASTER == rank) {
 		assert(test_config() == 1);
+		assert(test_split_command() == 1);
+		assert(test_command_timeout() == 1);
+		assert(test_stats() == 1);
+		assert(test_hash() == 1);
 	}
 	fflush(stdout);
 	fflush(stderr);